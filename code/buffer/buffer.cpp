@@ -1,6 +1,11 @@
 #include <sys/uio.h>
 
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
 #include "./buffer.h"
+#include "./buffer_search.h"
 
 /***************************************************
  * Buffer structure
@@ -18,14 +23,35 @@
  *
  ****************************************************/
 
-Buffer::Buffer(int initBuffSize) : buffer(initBuffSize), read_pos(0), write_pos(0) {}
+namespace {
+
+const size_t MIN_READ_HINT = 1024;
+const size_t MAX_READ_HINT = 65536;
+
+// Reads shrinking read_hint must stay below a quarter of it this many times in a row.
+const int SHRINK_AFTER_READS = 8;
+
+// Catches whatever does not fit into the Buffer, shared by all Buffers of a thread.
+thread_local char spill_area[MAX_READ_HINT];
+
+} // namespace
+
+Buffer::Buffer(int initBuffSize) : read_pos(0), write_pos(0),
+                                   read_hint(MIN_READ_HINT), small_reads(0),
+                                   read_histogram() {
+    buffer = BufferPool::Borrow(initBuffSize, &capacity);
+}
+
+Buffer::~Buffer() {
+    BufferPool::Return(buffer, capacity);
+}
 
 size_t Buffer::ReadableBytes() const {
     return write_pos - read_pos;
 }
 
 size_t Buffer::WritableBytes() const {
-    return buffer.size() - write_pos;
+    return capacity - write_pos;
 }
 
 size_t Buffer::PrependableBytes() const {
@@ -47,7 +73,6 @@ void Buffer::RetrieveUntil(const char* end) {
 }
 
 void Buffer::RetrieveAll() {
-    bzero(&buffer[0], buffer.size());
     read_pos = 0;
     write_pos = 0;
 }
@@ -70,6 +95,18 @@ void Buffer::HasWritten(size_t len) {
     write_pos += len;
 }
 
+const char* Buffer::FindCRLF() const {
+    return buffer_search::FindCRLF(Peek(), BeginWriteConst());
+}
+
+const char* Buffer::FindHeaderEnd() const {
+    return buffer_search::FindHeaderEnd(Peek(), BeginWriteConst());
+}
+
+const char* Buffer::FindByte(char c) const {
+    return buffer_search::FindByte(Peek(), BeginWriteConst(), c);
+}
+
 void Buffer::Append(const std::string& str) {
     Append(str.data(), str.length());
 }
@@ -90,6 +127,46 @@ void Buffer::Append(const Buffer& buff) {
     Append(buff.Peek(), buff.ReadableBytes());
 }
 
+void Buffer::AppendView(std::string_view str) {
+    Append(str.data(), str.length());
+}
+
+void Buffer::AppendInt(long long value) {
+    // 20 digits and a sign cover any long long.
+    EnsureWriteable(21);
+    std::to_chars_result res = std::to_chars(BeginWrite(), BeginWrite() + 21, value);
+    HasWritten(res.ptr - BeginWrite());
+}
+
+void Buffer::AppendUInt(unsigned long long value) {
+    EnsureWriteable(20);
+    std::to_chars_result res = std::to_chars(BeginWrite(), BeginWrite() + 20, value);
+    HasWritten(res.ptr - BeginWrite());
+}
+
+void Buffer::AppendFormat(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    AppendFormatV(format, args);
+    va_end(args);
+}
+
+void Buffer::AppendFormatV(const char* format, va_list args) {
+    assert(format);
+    va_list retry;
+    va_copy(retry, args);
+    // The first attempt formats in place, a second one only runs when
+    // the output did not fit.
+    int n = vsnprintf(BeginWrite(), WritableBytes(), format, args);
+    assert(n >= 0);
+    if(static_cast<size_t>(n) >= WritableBytes()) {
+        EnsureWriteable(n + 1);
+        n = vsnprintf(BeginWrite(), WritableBytes(), format, retry);
+    }
+    va_end(retry);
+    HasWritten(n);
+}
+
 void Buffer::EnsureWriteable(size_t len) {
     if(WritableBytes() < len) {
         MakeSpace(len);
@@ -99,16 +176,25 @@ void Buffer::EnsureWriteable(size_t len) {
 }
 
 char* Buffer::BeginPtr() {
-    return &(*(buffer.begin()));
+    return buffer;
 }
 
 const char* Buffer::BeginPtr() const {
-    return &(*(buffer.begin()));
+    return buffer;
 }
 
 void Buffer::MakeSpace(size_t len) {
     if(WritableBytes() + PrependableBytes() < len) {
-        buffer.resize(write_pos + len + 1);
+        // Moves only the readable bytes into a bigger block from the pool.
+        size_t readable = ReadableBytes();
+        size_t new_capacity;
+        char* new_buffer = BufferPool::Borrow(readable + len + 1, &new_capacity);
+        std::copy(BeginPtr() + read_pos, BeginPtr() + write_pos, new_buffer);
+        BufferPool::Return(buffer, capacity);
+        buffer = new_buffer;
+        capacity = new_capacity;
+        read_pos = 0;
+        write_pos = readable;
     }
     else {
         size_t readable = ReadableBytes();
@@ -119,26 +205,70 @@ void Buffer::MakeSpace(size_t len) {
     }
 }
 
+void Buffer::Shrink(size_t len) {
+    assert(ReadableBytes() == 0);
+    size_t new_capacity;
+    char* new_buffer = BufferPool::Borrow(len, &new_capacity);
+    BufferPool::Return(buffer, capacity);
+    buffer = new_buffer;
+    capacity = new_capacity;
+    read_pos = 0;
+    write_pos = 0;
+}
+
 ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-    char buff[65535];
+    // The learned size shrank well below the block, e.g. after one large
+    // upload, so the block goes back to the pool while nothing is in it.
+    if(ReadableBytes() == 0 && read_hint < capacity / 4) {
+        Shrink(read_hint);
+    }
+    // Grows the Buffer itself to the learned size, the spill area only
+    // catches reads bigger than anything seen so far.
+    EnsureWriteable(read_hint);
+
     struct iovec iov[2];
     const size_t writable = WritableBytes();
     
     iov[0].iov_base = BeginPtr() + write_pos;
     iov[0].iov_len = writable;
-    iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
+    iov[1].iov_base = spill_area;
+    iov[1].iov_len = sizeof(spill_area);
 
     const ssize_t len = readv(fd, iov, 2);
     if(len < 0) {
         *saveErrno = errno;
+        return len;
     }
-    else if(static_cast<size_t>(len) <= writable) {
+
+    const size_t n = static_cast<size_t>(len);
+    if(n <= writable) {
         write_pos += len;
     }
     else {
-        write_pos = buffer.size();
-        Append(buff, len - writable);
+        write_pos = capacity;
+        Append(spill_area, n - writable);
+    }
+
+    size_t bucket = 0;
+    while(bucket + 1 < READ_HISTOGRAM_BUCKETS && (static_cast<size_t>(64) << bucket) <= n) {
+        ++bucket;
+    }
+    ++read_histogram[bucket];
+
+    // A read that filled the offered space asks for more next time,
+    // a run of small reads lowers it, and with it the block kept.
+    if(n >= writable) {
+        read_hint = std::min(MAX_READ_HINT, BufferPool::BlockSize(n + 1));
+        small_reads = 0;
+    }
+    else if(n < read_hint / 4 && read_hint > MIN_READ_HINT) {
+        if(++small_reads >= SHRINK_AFTER_READS) {
+            read_hint /= 2;
+            small_reads = 0;
+        }
+    }
+    else {
+        small_reads = 0;
     }
     return len;
 }
@@ -153,3 +283,8 @@ ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
     read_pos += len;
     return len;
 }
+
+size_t Buffer::ReadHistogram(size_t bucket) const {
+    assert(bucket < READ_HISTOGRAM_BUCKETS);
+    return read_histogram[bucket];
+}
@@ -4,10 +4,13 @@
 #include <cstring>
 #include <iostream>
 #include <vector>
-#include <atomic>
+#include <string_view>
+#include <stdarg.h>
 #include <unistd.h>
 #include <assert.h>
 
+#include "./buffer_pool.h"
+
 /***************************************************
  * Buffer structure
  *
@@ -22,13 +25,31 @@
  * 1 : read_pos <---+             |
  * 2 : write_pos <----------------+
  *
+ * The storage is a block borrowed from the thread-local BufferPool.
+ * A Buffer is used by one thread at a time, RingBuffer is the variant
+ * for handing bytes from one thread to another.
+ *
  ****************************************************/
 
 class Buffer {
+public:
+    static constexpr size_t READ_HISTOGRAM_BUCKETS = 12;
+
 private:
-    std::vector<char> buffer;
-    std::atomic<std::size_t> read_pos;
-    std::atomic<std::size_t> write_pos;
+    char* buffer;
+    size_t capacity;
+    size_t read_pos;
+    size_t write_pos;
+
+    // Learned size of a typical read on this Buffer, see ReadFd.
+    size_t read_hint;
+
+    // Consecutive reads far below read_hint, used to shrink it again.
+    int small_reads;
+
+    // read_histogram[i] counts reads of [2^(i + 5), 2^(i + 6)) bytes,
+    // the first and last buckets are open-ended.
+    size_t read_histogram[READ_HISTOGRAM_BUCKETS];
 
     char* BeginPtr();
     const char* BeginPtr() const;
@@ -36,9 +57,15 @@ private:
     // Reserves "len" bytes of space in the Buffer. 
     void MakeSpace(size_t len);
 
+    // Swaps an empty Buffer's storage for a block of "len" bytes.
+    void Shrink(size_t len);
+
 public:
     Buffer(int init_buffer_size = 1024);
-    ~Buffer() = default;
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
     /*
      * WritableBytes returns writable bytes.
@@ -67,6 +94,7 @@ public:
     void RetrieveUntil(const char* end);
 
     // Retrieves all readable data in Buffer, that is to say, "clears" Buffer.
+    // Only the cursors are reset, the old bytes are left in place.
     void RetrieveAll();
 
     // Retrieves the rest data in readable section and returns them in std::string type.
@@ -76,14 +104,43 @@ public:
     const char* BeginWriteConst() const;
     char* BeginWrite();
 
+    /*
+     * Delimiter search over the readable section, vectorized where the CPU allows.
+     * Each returns a pointer usable with RetrieveUntil, or BeginWriteConst()
+     * when there is no match.
+     *
+     * FindCRLF finds "\r\n", FindHeaderEnd finds "\r\n\r\n",
+     * FindByte finds "c", e.g. ':' or ' '.
+     */
+    const char* FindCRLF() const;
+    const char* FindHeaderEnd() const;
+    const char* FindByte(char c) const;
+
     // Appends Buffer.
     void Append(const std::string& str);
     void Append(const char* str, size_t len);
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
 
+    // Appends without building a temporary std::string.
+    void AppendView(std::string_view str);
+    void AppendInt(long long value);
+    void AppendUInt(unsigned long long value);
+
+    // Appends printf-style output, growing the Buffer when it does not fit.
+    void AppendFormat(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void AppendFormatV(const char* format, va_list args);
+
+    // Reads into the Buffer, growing it in place to the learned read size.
+    // An empty Buffer holding far more than that hands the rest back first.
     ssize_t ReadFd(int fd, int* Errno);
     ssize_t WriteFd(int fd, int* Errno);
+
+    // Returns the learned read size.
+    size_t ReadHint() const { return read_hint; }
+
+    // Returns how many reads fell into "bucket", see read_histogram.
+    size_t ReadHistogram(size_t bucket) const;
 };
 
 #endif
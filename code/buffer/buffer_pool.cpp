@@ -0,0 +1,211 @@
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+#include "./buffer_pool.h"
+
+std::mutex BufferPool::registry_mtx;
+std::vector<BufferPool*> BufferPool::registry;
+
+namespace {
+
+// The pointer stays readable after the owner is released at thread exit,
+// so late Returns (e.g. from static objects) fall back to free().
+thread_local BufferPool* tls_pool = nullptr;
+thread_local bool tls_pool_dead = false;
+
+} // namespace
+
+struct BufferPool::Holder {
+    ~Holder() {
+        tls_pool_dead = true;
+        if(tls_pool) {
+            tls_pool->Trim(0);
+            tls_pool->Unref();
+            tls_pool = nullptr;
+        }
+    }
+};
+
+BufferPool::BufferPool()
+    : high_water(DEFAULT_HIGH_WATER), borrows(0), hits(0), returns(0),
+      trimmed(0), cached_bytes(0), borrowed_bytes(0), refs(1) {
+    std::lock_guard<std::mutex> locker(registry_mtx);
+    registry.push_back(this);
+}
+
+BufferPool::~BufferPool() {
+    {
+        std::lock_guard<std::mutex> locker(registry_mtx);
+        registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+    }
+    Trim(0);
+}
+
+BufferPool* BufferPool::Instance() {
+    if(tls_pool == nullptr && !tls_pool_dead) {
+        static thread_local Holder holder;
+        tls_pool = new BufferPool;
+    }
+    return tls_pool;
+}
+
+size_t BufferPool::BlockSize(size_t len) {
+    size_t size = static_cast<size_t>(1) << MIN_BLOCK_SHIFT;
+    while(size < len) {
+        size <<= 1;
+    }
+    return size;
+}
+
+size_t BufferPool::ClassIndex(size_t capacity) {
+    size_t index = 0;
+    while((static_cast<size_t>(1) << (MIN_BLOCK_SHIFT + index)) < capacity) {
+        ++index;
+    }
+    return index;
+}
+
+void BufferPool::Unref() {
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+char* BufferPool::Allocate(size_t capacity) {
+    char* raw = static_cast<char*>(malloc(HEADER_BYTES + capacity));
+    if(!raw) {
+        throw std::bad_alloc();
+    }
+    char* block = raw + HEADER_BYTES;
+    Owner(block) = nullptr;
+    return block;
+}
+
+void BufferPool::Free(char* block) {
+    free(block - HEADER_BYTES);
+}
+
+BufferPool*& BufferPool::Owner(char* block) {
+    return *reinterpret_cast<BufferPool**>(block - HEADER_BYTES);
+}
+
+void BufferPool::Settle(char* block, size_t capacity) {
+    BufferPool* owner = Owner(block);
+    if(owner) {
+        Owner(block) = nullptr;
+        owner->borrowed_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+        owner->Unref();
+    }
+}
+
+void BufferPool::Bump(std::atomic<size_t>& counter, size_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void BufferPool::Drop(std::atomic<size_t>& counter, size_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+}
+
+char* BufferPool::Borrow(size_t len, size_t* capacity) {
+    BufferPool* pool = Instance();
+    if(pool) {
+        return pool->Get(len, capacity);
+    }
+    *capacity = BlockSize(len);
+    return Allocate(*capacity);
+}
+
+void BufferPool::Return(char* block, size_t capacity) {
+    if(!block) {
+        return;
+    }
+    BufferPool* pool = Instance();
+    if(pool) {
+        pool->Put(block, capacity);
+    }
+    else {
+        Settle(block, capacity);
+        Free(block);
+    }
+}
+
+char* BufferPool::Get(size_t len, size_t* capacity) {
+    *capacity = BlockSize(len);
+    Bump(borrows, 1);
+
+    char* block = nullptr;
+    size_t index = ClassIndex(*capacity);
+    if(index < CLASS_COUNT && !free_list[index].empty()) {
+        block = free_list[index].back();
+        free_list[index].pop_back();
+        Bump(hits, 1);
+        Drop(cached_bytes, *capacity);
+    }
+    else {
+        block = Allocate(*capacity);
+    }
+    Owner(block) = this;
+    borrowed_bytes.fetch_add(*capacity, std::memory_order_relaxed);
+    refs.fetch_add(1, std::memory_order_relaxed);
+    return block;
+}
+
+void BufferPool::Put(char* block, size_t capacity) {
+    Bump(returns, 1);
+    // Blocks lent out by another thread's pool are counted there.
+    Settle(block, capacity);
+
+    size_t index = ClassIndex(capacity);
+    if(index >= CLASS_COUNT || cached_bytes.load(std::memory_order_relaxed) + capacity > high_water) {
+        Bump(trimmed, 1);
+        Free(block);
+        return;
+    }
+    free_list[index].push_back(block);
+    Bump(cached_bytes, capacity);
+}
+
+void BufferPool::Trim(size_t keep_bytes) {
+    // Large blocks go first, they are the most expensive to keep around.
+    for(size_t i = CLASS_COUNT; i-- > 0 && cached_bytes.load(std::memory_order_relaxed) > keep_bytes;) {
+        size_t size = static_cast<size_t>(1) << (MIN_BLOCK_SHIFT + i);
+        while(!free_list[i].empty() && cached_bytes.load(std::memory_order_relaxed) > keep_bytes) {
+            Free(free_list[i].back());
+            free_list[i].pop_back();
+            Drop(cached_bytes, size);
+            Bump(trimmed, 1);
+        }
+    }
+}
+
+void BufferPool::SetHighWater(size_t high_water) {
+    this->high_water = high_water;
+    Trim(high_water);
+}
+
+BufferPool::Stats BufferPool::GetStats() const {
+    Stats stats;
+    stats.borrows = borrows.load(std::memory_order_relaxed);
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.returns = returns.load(std::memory_order_relaxed);
+    stats.trimmed = trimmed.load(std::memory_order_relaxed);
+    stats.cached_bytes = cached_bytes.load(std::memory_order_relaxed);
+    stats.borrowed_bytes = borrowed_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+BufferPool::Stats BufferPool::GlobalStats() {
+    Stats total = {0, 0, 0, 0, 0, 0};
+    std::lock_guard<std::mutex> locker(registry_mtx);
+    for(const BufferPool* pool : registry) {
+        Stats stats = pool->GetStats();
+        total.borrows += stats.borrows;
+        total.hits += stats.hits;
+        total.returns += stats.returns;
+        total.trimmed += stats.trimmed;
+        total.cached_bytes += stats.cached_bytes;
+        total.borrowed_bytes += stats.borrowed_bytes;
+    }
+    return total;
+}
@@ -0,0 +1,123 @@
+#ifndef WEB_SERVER_BUFFER_BUFFER_POOL_H
+#define WEB_SERVER_BUFFER_BUFFER_POOL_H
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <assert.h>
+
+/***************************************************
+ * BufferPool
+ *
+ * A per-thread slab pool of power-of-two blocks.
+ *
+ * class 0    class 1    class 2          class N
+ * 1 KB       2 KB       4 KB      ...    1 MB
+ * +--+       +--+       +--+             +--+
+ * |  |->...  |  |->...  |  |->...        |  |->...
+ * +--+       +--+       +--+             +--+
+ *
+ * Buffers borrow blocks from the pool of the calling thread and
+ * return them to the pool of whichever thread releases them. Cached
+ * blocks beyond the high-water mark are freed back to the system.
+ * Requests larger than the biggest class bypass the pool.
+ *
+ *   block: |owner|pad|data ...               |
+ *                     ^ handed out, "capacity" bytes
+ *
+ * A lent block records its pool in a header in front of the data, so
+ * the bytes are settled with the pool that lent them whichever thread
+ * returns them. A pool outlives its thread until its last lent block
+ * is back.
+ *
+ ****************************************************/
+
+class BufferPool {
+public:
+    struct Stats {
+        size_t borrows;        // Borrow calls.
+        size_t hits;           // Borrows served from a free list.
+        size_t returns;        // Return calls.
+        size_t trimmed;        // Blocks freed because of the high-water mark.
+        size_t cached_bytes;   // Bytes sitting on the free lists.
+        size_t borrowed_bytes; // Bytes currently lent out by this pool.
+    };
+
+    static constexpr size_t MIN_BLOCK_SHIFT = 10;
+    static constexpr size_t MAX_BLOCK_SHIFT = 20;
+    static constexpr size_t DEFAULT_HIGH_WATER = 4 * 1024 * 1024;
+
+    // Returns the pool of the calling thread, or nullptr while the thread exits.
+    static BufferPool* Instance();
+
+    // Returns a block of at least "len" bytes. Its real size is stored in "capacity".
+    static char* Borrow(size_t len, size_t* capacity);
+
+    // Hands a block back to the pool of the calling thread.
+    static void Return(char* block, size_t capacity);
+
+    // Rounds "len" up to the block size the pool would hand out.
+    static size_t BlockSize(size_t len);
+
+    // Sums the statistics of all live pools.
+    static Stats GlobalStats();
+
+    Stats GetStats() const;
+
+    // Cached bytes above "high_water" are freed on Return.
+    void SetHighWater(size_t high_water);
+
+    // Frees cached blocks until at most "keep_bytes" remain.
+    void Trim(size_t keep_bytes = 0);
+
+private:
+    static constexpr size_t CLASS_COUNT = MAX_BLOCK_SHIFT - MIN_BLOCK_SHIFT + 1;
+
+    std::vector<char*> free_list[CLASS_COUNT];
+    size_t high_water;
+
+    // Written by the owning thread only, read by GlobalStats from any thread.
+    std::atomic<size_t> borrows;
+    std::atomic<size_t> hits;
+    std::atomic<size_t> returns;
+    std::atomic<size_t> trimmed;
+    std::atomic<size_t> cached_bytes;
+
+    // Written by whichever thread settles a block of this pool.
+    std::atomic<size_t> borrowed_bytes;
+
+    // Blocks lent out, plus one while the owning thread lives. The pool
+    // is deleted when it drops to 0.
+    std::atomic<size_t> refs;
+
+    static std::mutex registry_mtx;
+    static std::vector<BufferPool*> registry;
+
+    // In front of every block, keeps the data aligned like malloc's.
+    static constexpr size_t HEADER_BYTES = alignof(std::max_align_t);
+
+    BufferPool();
+    ~BufferPool();
+
+    static size_t ClassIndex(size_t capacity);
+    static void Bump(std::atomic<size_t>& counter, size_t n);
+    static void Drop(std::atomic<size_t>& counter, size_t n);
+
+    // Blocks with their header; the owner is null while not lent out.
+    static char* Allocate(size_t capacity);
+    static void Free(char* block);
+    static BufferPool*& Owner(char* block);
+
+    // Credits a block's bytes back to the pool that lent it.
+    static void Settle(char* block, size_t capacity);
+
+    // Releases the owning thread's reference at its exit.
+    struct Holder;
+    void Unref();
+
+    char* Get(size_t len, size_t* capacity);
+    void Put(char* block, size_t capacity);
+};
+
+#endif
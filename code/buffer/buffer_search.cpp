@@ -0,0 +1,120 @@
+#include <cstring>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define WEB_SERVER_BUFFER_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+#include "./buffer_search.h"
+
+namespace {
+
+typedef const char* (*FindFunc)(const char* begin, const char* end, const char* pattern);
+
+// Every search below looks for an N-byte pattern. A vector step compares
+// N shifted loads against the pattern bytes and ANDs the results, so bit i
+// of the mask is set iff the pattern starts at p + i.
+
+template<int N>
+const char* FindScalar(const char* begin, const char* end, const char* pattern) {
+    for(const char* p = begin; p + N <= end; ++p) {
+        if(p[0] == pattern[0] && memcmp(p, pattern, N) == 0) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef WEB_SERVER_BUFFER_SEARCH_X86
+
+template<int N>
+const char* FindSSE2(const char* begin, const char* end, const char* pattern) {
+    const char* p = begin;
+    while(end - p >= 16 + N - 1) {
+        __m128i match = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+                                       _mm_set1_epi8(pattern[0]));
+        for(int i = 1; i < N; ++i) {
+            __m128i next = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)),
+                                          _mm_set1_epi8(pattern[i]));
+            match = _mm_and_si128(match, next);
+        }
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(match));
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return FindScalar<N>(p, end, pattern);
+}
+
+template<int N>
+__attribute__((target("avx2")))
+const char* FindAVX2(const char* begin, const char* end, const char* pattern) {
+    const char* p = begin;
+    while(end - p >= 32 + N - 1) {
+        __m256i match = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)),
+                                          _mm256_set1_epi8(pattern[0]));
+        for(int i = 1; i < N; ++i) {
+            __m256i next = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)),
+                                             _mm256_set1_epi8(pattern[i]));
+            match = _mm256_and_si256(match, next);
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(match));
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return FindSSE2<N>(p, end, pattern);
+}
+
+#endif
+
+struct Impl {
+    const char* name;
+    FindFunc find_byte;
+    FindFunc find_crlf;
+    FindFunc find_header_end;
+};
+
+Impl Pick() {
+#ifdef WEB_SERVER_BUFFER_SEARCH_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return { "avx2", FindAVX2<1>, FindAVX2<2>, FindAVX2<4> };
+    }
+    return { "sse2", FindSSE2<1>, FindSSE2<2>, FindSSE2<4> };
+#else
+    return { "scalar", FindScalar<1>, FindScalar<2>, FindScalar<4> };
+#endif
+}
+
+const Impl& Selected() {
+    static const Impl impl = Pick();
+    return impl;
+}
+
+const char CRLF[] = "\r\n";
+const char CRLFCRLF[] = "\r\n\r\n";
+
+} // namespace
+
+namespace buffer_search {
+
+const char* FindByte(const char* begin, const char* end, char c) {
+    return Selected().find_byte(begin, end, &c);
+}
+
+const char* FindCRLF(const char* begin, const char* end) {
+    return Selected().find_crlf(begin, end, CRLF);
+}
+
+const char* FindHeaderEnd(const char* begin, const char* end) {
+    return Selected().find_header_end(begin, end, CRLFCRLF);
+}
+
+const char* Implementation() {
+    return Selected().name;
+}
+
+} // namespace buffer_search
@@ -0,0 +1,31 @@
+#ifndef WEB_SERVER_BUFFER_BUFFER_SEARCH_H
+#define WEB_SERVER_BUFFER_BUFFER_SEARCH_H
+
+#include <cstddef>
+
+/***************************************************
+ * Delimiter search over [begin, end).
+ *
+ * Each function returns a pointer to the first match, or "end" when
+ * there is none, the same contract as std::search. The implementation
+ * (AVX2, SSE2 or scalar) is picked once at runtime from the CPU flags.
+ *
+ ****************************************************/
+
+namespace buffer_search {
+
+// Finds the first byte equal to "c".
+const char* FindByte(const char* begin, const char* end, char c);
+
+// Finds the first "\r\n".
+const char* FindCRLF(const char* begin, const char* end);
+
+// Finds the first "\r\n\r\n".
+const char* FindHeaderEnd(const char* begin, const char* end);
+
+// Returns "avx2", "sse2" or "scalar".
+const char* Implementation();
+
+} // namespace buffer_search
+
+#endif
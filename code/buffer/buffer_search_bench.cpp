@@ -0,0 +1,123 @@
+/*
+ * buffer_search_bench: times the buffer_search routines against
+ * std::search and std::find on request headers of 200 B to 8 KB.
+ *
+ *   buffer_search_bench [iterations]
+ *
+ * Every header block is searched the way HttpRequest does it: the end
+ * of the header section, then each line by CRLF and the ':' in it. The
+ * results of both sides are compared, a mismatch exits with status 1.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "./buffer_search.h"
+
+namespace {
+
+const char CRLF[] = "\r\n";
+const char HEADER_END[] = "\r\n\r\n";
+
+const char* const HEADERS[] = {
+    "Host: www.example.com\r\n",
+    "Connection: keep-alive\r\n",
+    "Accept-Encoding: gzip, deflate, br\r\n",
+    "Accept-Language: en-US,en;q=0.5\r\n",
+    "Referer: https://www.example.com/index.html\r\n",
+    "Accept: image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n",
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n",
+};
+
+// A GET request with as many typical browser headers as fit in "size"
+// bytes, padded with cookies.
+std::string MakeHeaders(size_t size) {
+    std::string req = "GET /images/banner.jpg?width=1280 HTTP/1.1\r\n";
+    for(const char* header : HEADERS) {
+        if(req.size() + strlen(header) + 2 <= size) {
+            req += header;
+        }
+    }
+    int n = 0;
+    while(req.size() + 4 < size) {
+        std::string cookie = "Cookie: session_" + std::to_string(n++) + "=";
+        size_t room = size - 4 - req.size();
+        size_t value = std::min<size_t>(room > cookie.size() + 2 ? room - cookie.size() - 2 : 0, 96);
+        req += cookie + std::string(value, 'a' + n % 26) + "\r\n";
+    }
+    req += "\r\n";
+    return req;
+}
+
+// Returns a checksum of the positions found, so neither side is optimized away.
+template<typename Find, typename FindLine, typename FindColon>
+size_t Scan(const std::string& req, Find find_end, FindLine find_line, FindColon find_colon) {
+    const char* begin = req.data();
+    const char* end = begin + req.size();
+    const char* header_end = find_end(begin, end);
+    size_t sum = header_end - begin;
+    for(const char* line = begin; line < header_end;) {
+        const char* eol = find_line(line, end);
+        sum += (find_colon(line, eol) - begin) + (eol - begin);
+        line = eol + 2;
+    }
+    return sum;
+}
+
+size_t ScanSimd(const std::string& req) {
+    return Scan(req,
+        [](const char* b, const char* e) { return buffer_search::FindHeaderEnd(b, e); },
+        [](const char* b, const char* e) { return buffer_search::FindCRLF(b, e); },
+        [](const char* b, const char* e) { return buffer_search::FindByte(b, e, ':'); });
+}
+
+size_t ScanStd(const std::string& req) {
+    return Scan(req,
+        [](const char* b, const char* e) { return std::search(b, e, HEADER_END, HEADER_END + 4); },
+        [](const char* b, const char* e) { return std::search(b, e, CRLF, CRLF + 2); },
+        [](const char* b, const char* e) { return std::find(b, e, ':'); });
+}
+
+template<typename F>
+double NsPerScan(const std::string& req, int iterations, F scan, size_t& sum) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; ++i) {
+        // Read through a volatile, so the scan cannot be hoisted out of the loop.
+        const std::string* volatile target = &req;
+        sum += scan(*target);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+volatile size_t sink;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    if(iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    printf("implementation: %s\n", buffer_search::Implementation());
+    printf("%8s %14s %14s %8s\n", "bytes", "std ns/req", "simd ns/req", "speedup");
+    for(size_t size : {200, 512, 1024, 2048, 4096, 8192}) {
+        std::string req = MakeHeaders(size);
+        if(ScanSimd(req) != ScanStd(req)) {
+            fprintf(stderr, "mismatch at %zu bytes\n", size);
+            return 1;
+        }
+        size_t sum = 0;
+        int n = static_cast<int>(std::max<size_t>(1, static_cast<size_t>(iterations) * 1024 / size));
+        double std_ns = NsPerScan(req, n, ScanStd, sum);
+        double simd_ns = NsPerScan(req, n, ScanSimd, sum);
+        printf("%8zu %14.1f %14.1f %7.2fx\n", req.size(), std_ns, simd_ns, std_ns / simd_ns);
+        sink = sink + sum;
+    }
+    return 0;
+}
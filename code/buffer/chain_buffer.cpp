@@ -0,0 +1,277 @@
+#include <sys/uio.h>
+#include <limits.h>
+
+#include "./chain_buffer.h"
+
+ChainBuffer::Block::Block(size_t len) : read_pos(0), write_pos(0) {
+    data = BufferPool::Borrow(len, &capacity);
+}
+
+ChainBuffer::Block::Block(Block&& other) noexcept
+    : data(other.data), capacity(other.capacity),
+      read_pos(other.read_pos), write_pos(other.write_pos) {
+    other.data = nullptr;
+    other.capacity = 0;
+}
+
+ChainBuffer::Block& ChainBuffer::Block::operator=(Block&& other) noexcept {
+    if(this != &other) {
+        BufferPool::Return(data, capacity);
+        data = other.data;
+        capacity = other.capacity;
+        read_pos = other.read_pos;
+        write_pos = other.write_pos;
+        other.data = nullptr;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+ChainBuffer::Block::~Block() {
+    BufferPool::Return(data, capacity);
+}
+
+ChainBuffer::ChainBuffer() : readable(0) {}
+
+size_t ChainBuffer::ReadableBytes() const {
+    return readable;
+}
+
+size_t ChainBuffer::WritableBytes() const {
+    return blocks.empty() ? 0 : blocks.back().WritableBytes();
+}
+
+size_t ChainBuffer::ContiguousBytes() const {
+    return blocks.empty() ? 0 : blocks.front().ReadableBytes();
+}
+
+const char* ChainBuffer::Peek() const {
+    if(blocks.empty()) {
+        return nullptr;
+    }
+    const Block& front = blocks.front();
+    return front.data + front.read_pos;
+}
+
+const char* ChainBuffer::Pullup(size_t len) {
+    assert(len <= readable);
+    if(len <= ContiguousBytes()) {
+        return Peek();
+    }
+
+    Block merged(len);
+    size_t left = len;
+    while(left > 0) {
+        Block& front = blocks.front();
+        size_t n = std::min(left, front.ReadableBytes());
+        std::copy(front.data + front.read_pos,
+                  front.data + front.read_pos + n,
+                  merged.data + merged.write_pos);
+        merged.write_pos += n;
+        front.read_pos += n;
+        left -= n;
+        if(front.ReadableBytes() == 0 && blocks.size() > 1) {
+            PopBlock();
+        }
+    }
+    blocks.push_front(std::move(merged));
+    return Peek();
+}
+
+void ChainBuffer::EnsureWriteable(size_t len) {
+    if(WritableBytes() < len) {
+        AddBlock(len);
+    }
+
+    assert(WritableBytes() >= len);
+}
+
+void ChainBuffer::HasWritten(size_t len) {
+    assert(!blocks.empty() && len <= blocks.back().WritableBytes());
+    blocks.back().write_pos += len;
+    readable += len;
+}
+
+void ChainBuffer::Retrieve(size_t len) {
+    assert(len <= readable);
+    readable -= len;
+    while(len > 0) {
+        Block& front = blocks.front();
+        size_t n = std::min(len, front.ReadableBytes());
+        front.read_pos += n;
+        len -= n;
+        if(front.ReadableBytes() == 0) {
+            if(blocks.size() > 1) {
+                PopBlock();
+            }
+            else {
+                front.read_pos = front.write_pos = 0;
+            }
+        }
+    }
+}
+
+void ChainBuffer::RetrieveUntil(const char* end) {
+    assert(Peek() <= end && end <= Peek() + ContiguousBytes());
+    Retrieve(end - Peek());
+}
+
+void ChainBuffer::RetrieveAll() {
+    while(blocks.size() > 1) {
+        PopBlock();
+    }
+    if(!blocks.empty()) {
+        blocks.front().read_pos = blocks.front().write_pos = 0;
+    }
+    readable = 0;
+}
+
+std::string ChainBuffer::RetrieveAllToStr() {
+    std::string str;
+    str.reserve(readable);
+    for(const Block& block : blocks) {
+        str.append(block.data + block.read_pos, block.ReadableBytes());
+    }
+    RetrieveAll();
+    return str;
+}
+
+const char* ChainBuffer::BeginWriteConst() const {
+    if(blocks.empty()) {
+        return nullptr;
+    }
+    const Block& back = blocks.back();
+    return back.data + back.write_pos;
+}
+
+char* ChainBuffer::BeginWrite() {
+    if(blocks.empty()) {
+        return nullptr;
+    }
+    Block& back = blocks.back();
+    return back.data + back.write_pos;
+}
+
+void ChainBuffer::Append(const std::string& str) {
+    Append(str.data(), str.length());
+}
+
+void ChainBuffer::Append(const void* data, size_t len) {
+    assert(data);
+    Append(static_cast<const char*>(data), len);
+}
+
+void ChainBuffer::Append(const char* str, size_t len) {
+    assert(str);
+    while(len > 0) {
+        if(WritableBytes() == 0) {
+            AddBlock(len);
+        }
+        size_t n = std::min(len, WritableBytes());
+        std::copy(str, str + n, BeginWrite());
+        HasWritten(n);
+        str += n;
+        len -= n;
+    }
+}
+
+void ChainBuffer::Append(const Buffer& buff) {
+    Append(buff.Peek(), buff.ReadableBytes());
+}
+
+void ChainBuffer::AddBlock(size_t len) {
+    // An empty back Block is replaced instead of being left in the chain.
+    if(!blocks.empty() && blocks.back().ReadableBytes() == 0 && blocks.back().capacity >= len) {
+        blocks.back().read_pos = blocks.back().write_pos = 0;
+        return;
+    }
+    if(!blocks.empty() && blocks.back().ReadableBytes() == 0) {
+        spare.push_back(std::move(blocks.back()));
+        blocks.pop_back();
+    }
+
+    if(len <= BLOCK_SIZE && !spare.empty()) {
+        blocks.push_back(std::move(spare.back()));
+        spare.pop_back();
+    }
+    else {
+        blocks.emplace_back(len <= BLOCK_SIZE ? BLOCK_SIZE : len);
+    }
+    blocks.back().read_pos = blocks.back().write_pos = 0;
+}
+
+void ChainBuffer::PopBlock() {
+    assert(!blocks.empty());
+    // Oversized Blocks are freed, fixed-size ones are kept for reuse.
+    if(blocks.front().capacity == BLOCK_SIZE && spare.size() < READ_BLOCKS) {
+        spare.push_back(std::move(blocks.front()));
+    }
+    blocks.pop_front();
+}
+
+ssize_t ChainBuffer::ReadFd(int fd, int* saveErrno) {
+    // Offers the free tail of the back Block plus READ_BLOCKS spare Blocks.
+    while(spare.size() < READ_BLOCKS) {
+        spare.emplace_back(BLOCK_SIZE);
+    }
+
+    struct iovec iov[READ_BLOCKS + 1];
+    int cnt = 0;
+    if(WritableBytes() > 0) {
+        iov[cnt].iov_base = BeginWrite();
+        iov[cnt].iov_len = WritableBytes();
+        ++cnt;
+    }
+    for(auto it = spare.rbegin(); it != spare.rend() && static_cast<size_t>(cnt) <= READ_BLOCKS; ++it) {
+        iov[cnt].iov_base = it->data;
+        iov[cnt].iov_len = it->capacity;
+        ++cnt;
+    }
+
+    const ssize_t len = readv(fd, iov, cnt);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+
+    size_t left = static_cast<size_t>(len);
+    size_t n = std::min(left, WritableBytes());
+    if(n > 0) {
+        HasWritten(n);
+        left -= n;
+    }
+    while(left > 0) {
+        // Spare Blocks were offered in the same order they are popped here.
+        blocks.push_back(std::move(spare.back()));
+        spare.pop_back();
+        blocks.back().read_pos = blocks.back().write_pos = 0;
+        n = std::min(left, blocks.back().capacity);
+        HasWritten(n);
+        left -= n;
+    }
+    return len;
+}
+
+ssize_t ChainBuffer::WriteFd(int fd, int* saveErrno) {
+    struct iovec iov[IOV_MAX];
+    int cnt = 0;
+    for(auto it = blocks.begin(); it != blocks.end() && cnt < IOV_MAX; ++it) {
+        if(it->ReadableBytes() == 0) {
+            continue;
+        }
+        iov[cnt].iov_base = it->data + it->read_pos;
+        iov[cnt].iov_len = it->ReadableBytes();
+        ++cnt;
+    }
+    if(cnt == 0) {
+        return 0;
+    }
+
+    ssize_t len = writev(fd, iov, cnt);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+    Retrieve(len);
+    return len;
+}
@@ -0,0 +1,124 @@
+#ifndef WEB_SERVER_BUFFER_CHAIN_BUFFER_H
+#define WEB_SERVER_BUFFER_CHAIN_BUFFER_H
+
+#include <cstring>
+#include <string>
+#include <deque>
+#include <vector>
+#include <unistd.h>
+#include <assert.h>
+
+#include "./buffer.h"
+
+/***************************************************
+ * ChainBuffer structure
+ *
+ *   Block 0           Block 1           Block 2
+ * +-----+-------+   +-------------+   +-------+-----+
+ * |     |#######|-->|#############|-->|#######|     |
+ * +-----+-------+   +-------------+   +-------+-----+
+ *       |                                     |
+ *       read_pos of the front Block           write_pos of the back Block
+ *
+ * Data is stored in a chain of fixed-size Blocks. Appending only
+ * fills the back Block or links a new one, so bytes already stored
+ * are never moved. ReadFd fills free Blocks with one readv, WriteFd
+ * drains all Blocks with one writev.
+ *
+ ****************************************************/
+
+class ChainBuffer {
+private:
+    static constexpr size_t BLOCK_SIZE = 4096;
+
+    // Number of free Blocks offered to one readv call.
+    static constexpr size_t READ_BLOCKS = 4;
+
+    // Block storage is borrowed from the thread-local BufferPool.
+    struct Block {
+        char* data;
+        size_t capacity;
+        size_t read_pos;
+        size_t write_pos;
+
+        explicit Block(size_t len);
+        Block(Block&& other) noexcept;
+        Block& operator=(Block&& other) noexcept;
+        ~Block();
+
+        size_t ReadableBytes() const { return write_pos - read_pos; }
+        size_t WritableBytes() const { return capacity - write_pos; }
+    };
+
+    std::deque<Block> blocks;
+
+    // Emptied Blocks kept for reuse, so a steady stream does not allocate.
+    std::vector<Block> spare;
+
+    size_t readable;
+
+    // Links a Block of at least "len" bytes to the back of the chain.
+    void AddBlock(size_t len);
+
+    // Returns the front Block to the spare list.
+    void PopBlock();
+
+public:
+    ChainBuffer();
+    ~ChainBuffer() = default;
+
+    ChainBuffer(const ChainBuffer&) = delete;
+    ChainBuffer& operator=(const ChainBuffer&) = delete;
+
+    /*
+     * ReadableBytes returns readable bytes of the whole chain.
+     *
+     * WritableBytes returns writable bytes of the back Block.
+     *
+     * ContiguousBytes returns readable bytes of the front Block, that is,
+     * how many bytes starting at Peek() can be accessed directly.
+     */
+    size_t ReadableBytes() const;
+    size_t WritableBytes() const;
+    size_t ContiguousBytes() const;
+
+    // Returns a pointer to read_pos of the front Block.
+    const char* Peek() const;
+
+    // Makes the first "len" readable bytes contiguous and returns a pointer to them.
+    // This is the only operation that moves stored bytes.
+    const char* Pullup(size_t len);
+
+    // Ensures the back Block has "len" writable bytes, linking a new Block if needed.
+    void EnsureWriteable(size_t len);
+
+    // Updates "len" bytes for write_pos of the back Block.
+    void HasWritten(size_t len);
+
+    // Updates "len" bytes for read_pos, releasing emptied Blocks.
+    void Retrieve(size_t len);
+
+    // Updates "end - Peek()" bytes for read_pos. "end" must lie in the front Block.
+    void RetrieveUntil(const char* end);
+
+    // Retrieves all readable data in ChainBuffer.
+    void RetrieveAll();
+
+    // Retrieves the rest data in readable section and returns them in std::string type.
+    std::string RetrieveAllToStr();
+
+    // Returns a pointer to write_pos of the back Block.
+    const char* BeginWriteConst() const;
+    char* BeginWrite();
+
+    // Appends ChainBuffer.
+    void Append(const std::string& str);
+    void Append(const char* str, size_t len);
+    void Append(const void* data, size_t len);
+    void Append(const Buffer& buff);
+
+    ssize_t ReadFd(int fd, int* Errno);
+    ssize_t WriteFd(int fd, int* Errno);
+};
+
+#endif
@@ -0,0 +1,304 @@
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include "./io_uring_backend.h"
+
+namespace {
+
+// The group id the receive blocks are registered under.
+const uint16_t RECV_GROUP = 0;
+
+int SysSetup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int SysEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int SysRegister(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+} // namespace
+
+IoUringBackend::IoUringBackend()
+    : ring_fd(-1), sq_ptr(nullptr), sq_size(0), cq_ptr(nullptr), cq_size(0),
+      sqes(nullptr), sqes_size(0), sq_head(nullptr), sq_tail(nullptr), sq_mask(0),
+      sq_array(nullptr), to_submit(0), cq_head(nullptr), cq_tail(nullptr), cq_mask(0),
+      cqes(nullptr), buf_ring(nullptr), buf_ring_size(0), recv_slab(nullptr),
+      recv_blocks(0), recv_block_size(0), buf_tail(0) {}
+
+IoUringBackend::~IoUringBackend() {
+    Close();
+}
+
+bool IoUringBackend::Init(unsigned entries, unsigned recv_blocks, unsigned recv_block_size) {
+    assert(ring_fd < 0);
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = SysSetup(entries, &params);
+    if(ring_fd < 0) {
+        return false;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if(sq_ptr == MAP_FAILED) {
+        sq_ptr = nullptr;
+        Close();
+        return false;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr = sq_ptr;
+    }
+    else {
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_CQ_RING);
+        if(cq_ptr == MAP_FAILED) {
+            cq_ptr = nullptr;
+            Close();
+            return false;
+        }
+    }
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd, IORING_OFF_SQES);
+    if(sqes_ptr == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe*>(sqes_ptr);
+
+    char* sq = static_cast<char*>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    char* cq = static_cast<char*>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // At most one request per CQ slot can be in flight, so the CQ never overflows.
+    requests.assign(params.cq_entries, Request{OP_NONE, -1, nullptr});
+    free_requests.clear();
+    for(uint32_t i = params.cq_entries; i-- > 0;) {
+        free_requests.push_back(i);
+    }
+
+    this->recv_blocks = recv_blocks;
+    this->recv_block_size = recv_block_size;
+    SetupBufRing();
+    return true;
+}
+
+bool IoUringBackend::SetupBufRing() {
+    // The ring size must be a power of two that fits the 16-bit buffer ids.
+    unsigned entries = 1;
+    while(entries < recv_blocks && entries < 32768) {
+        entries <<= 1;
+    }
+    recv_blocks = entries;
+
+    buf_ring_size = entries * sizeof(struct io_uring_buf);
+    void* ring = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED) {
+        return false;
+    }
+    void* slab = mmap(nullptr, static_cast<size_t>(entries) * recv_block_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(slab == MAP_FAILED) {
+        munmap(ring, buf_ring_size);
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = entries;
+    reg.bgid = RECV_GROUP;
+    if(SysRegister(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(slab, static_cast<size_t>(entries) * recv_block_size);
+        munmap(ring, buf_ring_size);
+        return false;
+    }
+
+    buf_ring = static_cast<struct io_uring_buf_ring*>(ring);
+    recv_slab = static_cast<char*>(slab);
+    buf_tail = 0;
+    for(unsigned bid = 0; bid < entries; ++bid) {
+        RecycleBlock(static_cast<uint16_t>(bid));
+    }
+    return true;
+}
+
+void IoUringBackend::RecycleBlock(uint16_t bid) {
+    // Indexes the ring memory directly: in C++ the header's flex-array wrapper
+    // places "bufs" after an empty struct, 8 bytes away from where the kernel looks.
+    struct io_uring_buf* block = reinterpret_cast<struct io_uring_buf*>(buf_ring) + (buf_tail & (recv_blocks - 1));
+    block->addr = reinterpret_cast<uint64_t>(recv_slab + static_cast<size_t>(bid) * recv_block_size);
+    block->len = recv_block_size;
+    block->bid = bid;
+    ++buf_tail;
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* IoUringBackend::NextSqe(int fd, Buffer* buff, Op op) {
+    assert(IsOpen() && buff);
+    unsigned tail = *sq_tail;
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if(tail - head > sq_mask || free_requests.empty()) {
+        return nullptr;
+    }
+
+    uint32_t id = free_requests.back();
+    free_requests.pop_back();
+    requests[id] = Request{op, fd, buff};
+
+    unsigned index = tail & sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fd;
+    sqe->user_data = id;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit;
+    return sqe;
+}
+
+bool IoUringBackend::PrepRead(int fd, Buffer* buff) {
+    if(!buf_ring) {
+        // No provided buffers: read straight into the Buffer, like ReadFd does.
+        buff->EnsureWriteable(buff->ReadHint());
+    }
+    struct io_uring_sqe* sqe = NextSqe(fd, buff, OP_READ);
+    if(!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->off = static_cast<uint64_t>(-1);
+    if(buf_ring) {
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RECV_GROUP;
+        sqe->len = recv_block_size;
+    }
+    else {
+        sqe->addr = reinterpret_cast<uint64_t>(buff->BeginWrite());
+        sqe->len = static_cast<uint32_t>(buff->WritableBytes());
+    }
+    return true;
+}
+
+bool IoUringBackend::PrepWrite(int fd, Buffer* buff) {
+    struct io_uring_sqe* sqe = NextSqe(fd, buff, OP_WRITE);
+    if(!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->addr = reinterpret_cast<uint64_t>(buff->Peek());
+    sqe->len = static_cast<uint32_t>(buff->ReadableBytes());
+    return true;
+}
+
+int IoUringBackend::Submit(unsigned wait_nr) {
+    assert(IsOpen());
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = SysEnter(ring_fd, to_submit, wait_nr, flags);
+    if(ret < 0) {
+        return -errno;
+    }
+    to_submit -= static_cast<unsigned>(ret) < to_submit ? static_cast<unsigned>(ret) : to_submit;
+    return ret;
+}
+
+int IoUringBackend::Reap(const CompletionCallBack& cb) {
+    assert(IsOpen());
+    int count = 0;
+    unsigned head = *cq_head;
+    while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe* cqe = &cqes[head & cq_mask];
+        uint32_t id = static_cast<uint32_t>(cqe->user_data);
+        int res = cqe->res;
+        unsigned cqe_flags = cqe->flags;
+        ++head;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        assert(id < requests.size());
+        Request req = requests[id];
+        requests[id].op = OP_NONE;
+        free_requests.push_back(id);
+
+        ssize_t len = res;
+        int err = 0;
+        if(res < 0) {
+            len = -1;
+            err = -res;
+        }
+        else if(req.op == OP_READ) {
+            if(cqe_flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = static_cast<uint16_t>(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+                req.buff->Append(recv_slab + static_cast<size_t>(bid) * recv_block_size, res);
+                RecycleBlock(bid);
+            }
+            else {
+                req.buff->HasWritten(res);
+            }
+        }
+        else if(req.op == OP_WRITE) {
+            req.buff->Retrieve(res);
+        }
+
+        if(cb) {
+            cb(req.fd, req.buff, len, err);
+        }
+        ++count;
+    }
+    return count;
+}
+
+void IoUringBackend::Close() {
+    if(buf_ring) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = RECV_GROUP;
+        SysRegister(ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(recv_slab, static_cast<size_t>(recv_blocks) * recv_block_size);
+        munmap(buf_ring, buf_ring_size);
+        buf_ring = nullptr;
+        recv_slab = nullptr;
+    }
+    if(sqes) {
+        munmap(sqes, sqes_size);
+        sqes = nullptr;
+    }
+    if(cq_ptr && cq_ptr != sq_ptr) {
+        munmap(cq_ptr, cq_size);
+    }
+    cq_ptr = nullptr;
+    if(sq_ptr) {
+        munmap(sq_ptr, sq_size);
+        sq_ptr = nullptr;
+    }
+    if(ring_fd >= 0) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    to_submit = 0;
+}
@@ -0,0 +1,110 @@
+#ifndef WEB_SERVER_BUFFER_IO_URING_BACKEND_H
+#define WEB_SERVER_BUFFER_IO_URING_BACKEND_H
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <sys/types.h>
+
+#include "./buffer.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/***************************************************
+ * IoUringBackend
+ *
+ *  PrepRead/PrepWrite     Submit            Reap
+ *  +-------------+      +--------+      +----------------+
+ *  | SQE  SQE ...| ---> | kernel | ---> | CQE -> Buffer  |
+ *  +-------------+      +--------+      +----------------+
+ *
+ * Batches reads and writes of many Buffers into one io_uring_enter.
+ * Reads select a block from a provided-buffer ring, so idle
+ * connections do not pin receive memory; on completion the bytes are
+ * appended to the owning Buffer and the block is recycled. Writes send
+ * the readable bytes of the Buffer and retrieve what went out.
+ *
+ * A Buffer must not be touched between its Prep call and its
+ * completion. When Init fails (no io_uring in the kernel) callers keep
+ * using Buffer::ReadFd/WriteFd.
+ *
+ ****************************************************/
+
+class IoUringBackend {
+public:
+    // "len" is the transferred byte count, or -1 with "err" set, like Buffer::ReadFd.
+    typedef std::function<void(int fd, Buffer* buff, ssize_t len, int err)> CompletionCallBack;
+
+    IoUringBackend();
+    ~IoUringBackend();
+
+    IoUringBackend(const IoUringBackend&) = delete;
+    IoUringBackend& operator=(const IoUringBackend&) = delete;
+
+    // Sets up the rings. Without provided-buffer ring support (kernels before 5.19)
+    // reads go straight into the Buffer's writable section instead.
+    bool Init(unsigned entries = 256, unsigned recv_blocks = 256, unsigned recv_block_size = 4096);
+    bool IsOpen() const { return ring_fd >= 0; }
+
+    // Queues a read into / a write from "buff". Returns false when the queue is full,
+    // Submit and Reap then free up room.
+    bool PrepRead(int fd, Buffer* buff);
+    bool PrepWrite(int fd, Buffer* buff);
+
+    // Hands every queued request to the kernel with one syscall and optionally
+    // waits for "wait_nr" completions. Returns the number submitted or -errno.
+    int Submit(unsigned wait_nr = 0);
+
+    // Applies finished requests to their Buffers and reports each through "cb".
+    // Returns the number of completions handled.
+    int Reap(const CompletionCallBack& cb);
+
+private:
+    enum Op { OP_NONE, OP_READ, OP_WRITE };
+
+    struct Request {
+        Op op;
+        int fd;
+        Buffer* buff;
+    };
+
+    int ring_fd;
+
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    unsigned to_submit;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    // Provided-buffer ring for reads, null when the kernel lacks it.
+    io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    char* recv_slab;
+    unsigned recv_blocks;
+    unsigned recv_block_size;
+    uint16_t buf_tail;
+
+    std::vector<Request> requests;
+    std::vector<uint32_t> free_requests;
+
+    io_uring_sqe* NextSqe(int fd, Buffer* buff, Op op);
+    void RecycleBlock(uint16_t bid);
+    bool SetupBufRing();
+    void Close();
+};
+
+#endif
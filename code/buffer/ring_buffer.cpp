@@ -0,0 +1,128 @@
+#include <sys/mman.h>
+#include <errno.h>
+#include <new>
+#include <algorithm>
+
+#include "./ring_buffer.h"
+
+RingBuffer::RingBuffer(size_t min_capacity) : base(nullptr), capacity(0), head(0), tail(0) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    capacity = page;
+    while(capacity < min_capacity) {
+        capacity <<= 1;
+    }
+
+    int fd = memfd_create("ring_buffer", MFD_CLOEXEC);
+    if(fd < 0) {
+        throw std::bad_alloc();
+    }
+    if(ftruncate(fd, capacity) < 0) {
+        close(fd);
+        throw std::bad_alloc();
+    }
+
+    // Reserves 2 * capacity of address space, then maps the memfd into both halves.
+    void* area = mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(area == MAP_FAILED) {
+        close(fd);
+        throw std::bad_alloc();
+    }
+    char* first = static_cast<char*>(area);
+    if(mmap(first, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+       mmap(first + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(area, 2 * capacity);
+        close(fd);
+        throw std::bad_alloc();
+    }
+    close(fd);
+    base = first;
+}
+
+RingBuffer::~RingBuffer() {
+    if(base) {
+        munmap(base, 2 * capacity);
+    }
+}
+
+size_t RingBuffer::WritableBytes() const {
+    return capacity - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+}
+
+char* RingBuffer::BeginWrite() {
+    return base + (tail.load(std::memory_order_relaxed) & (capacity - 1));
+}
+
+void RingBuffer::HasWritten(size_t len) {
+    assert(len <= WritableBytes());
+    tail.store(tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+size_t RingBuffer::Append(const char* str, size_t len) {
+    assert(str);
+    size_t n = std::min(len, WritableBytes());
+    std::copy(str, str + n, BeginWrite());
+    HasWritten(n);
+    return n;
+}
+
+size_t RingBuffer::Append(const std::string& str) {
+    return Append(str.data(), str.length());
+}
+
+ssize_t RingBuffer::ReadFd(int fd, int* saveErrno) {
+    const size_t writable = WritableBytes();
+    if(writable == 0) {
+        *saveErrno = ENOBUFS;
+        return -1;
+    }
+    ssize_t len = read(fd, BeginWrite(), writable);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+    HasWritten(len);
+    return len;
+}
+
+size_t RingBuffer::ReadableBytes() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+}
+
+const char* RingBuffer::Peek() const {
+    return base + (head.load(std::memory_order_relaxed) & (capacity - 1));
+}
+
+void RingBuffer::Retrieve(size_t len) {
+    assert(len <= ReadableBytes());
+    head.store(head.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+void RingBuffer::RetrieveUntil(const char* end) {
+    assert(Peek() <= end);
+    Retrieve(end - Peek());
+}
+
+void RingBuffer::RetrieveAll() {
+    head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+std::string RingBuffer::RetrieveAllToStr() {
+    size_t readable = ReadableBytes();
+    std::string str(Peek(), readable);
+    Retrieve(readable);
+    return str;
+}
+
+ssize_t RingBuffer::WriteFd(int fd, int* saveErrno) {
+    const size_t readable = ReadableBytes();
+    if(readable == 0) {
+        return 0;
+    }
+    ssize_t len = write(fd, Peek(), readable);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+    Retrieve(len);
+    return len;
+}
@@ -0,0 +1,87 @@
+#ifndef WEB_SERVER_BUFFER_RING_BUFFER_H
+#define WEB_SERVER_BUFFER_RING_BUFFER_H
+
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include <unistd.h>
+#include <assert.h>
+
+/***************************************************
+ * RingBuffer structure
+ *
+ *   base                       base + capacity
+ *   |                          |
+ *   +--------------------------+--------------------------+
+ *   |      memfd pages         |   same memfd pages       |
+ *   +--------------------------+--------------------------+
+ *          |           |             |
+ *          head        tail          head + capacity
+ *
+ * The same pages are mapped twice back to back, so every readable and
+ * every writable region is contiguous even when it wraps around, and
+ * nothing is ever copied to make space.
+ *
+ * Single producer, single consumer: one thread calls the producer
+ * methods, another one the consumer methods, without any lock.
+ * head and tail only grow, offsets are taken modulo capacity.
+ *
+ ****************************************************/
+
+class RingBuffer {
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    char* base;
+    size_t capacity;
+
+    // Written by the consumer only.
+    alignas(CACHE_LINE) std::atomic<size_t> head;
+
+    // Written by the producer only.
+    alignas(CACHE_LINE) std::atomic<size_t> tail;
+
+public:
+    // Capacity is rounded up to a power-of-two number of pages.
+    // Throws std::bad_alloc if the mirror mapping cannot be set up.
+    explicit RingBuffer(size_t min_capacity = 64 * 1024);
+    ~RingBuffer();
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    size_t Capacity() const { return capacity; }
+
+    /*
+     * Producer side.
+     *
+     * WritableBytes returns writable bytes, BeginWrite points at them.
+     * HasWritten publishes "len" bytes to the consumer.
+     * Append copies as many bytes as fit and returns that count.
+     * ReadFd reads from "fd" straight into the writable region. A full
+     * ring returns -1 with ENOBUFS in "Errno", 0 is only returned at EOF.
+     */
+    size_t WritableBytes() const;
+    char* BeginWrite();
+    void HasWritten(size_t len);
+    size_t Append(const char* str, size_t len);
+    size_t Append(const std::string& str);
+    ssize_t ReadFd(int fd, int* Errno);
+
+    /*
+     * Consumer side.
+     *
+     * ReadableBytes returns readable bytes, Peek points at them.
+     * Retrieve releases "len" bytes back to the producer.
+     * WriteFd writes the readable region to "fd".
+     */
+    size_t ReadableBytes() const;
+    const char* Peek() const;
+    void Retrieve(size_t len);
+    void RetrieveUntil(const char* end);
+    void RetrieveAll();
+    std::string RetrieveAllToStr();
+    ssize_t WriteFd(int fd, int* Errno);
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include <sys/mman.h>
+#include <zlib.h>
+#include <assert.h>
+
+#include "./compress_cache.h"
+
+CompressCache::CompressCache() : bytes(0), budget(DEFAULT_BUDGET), is_close(false) {
+    std::unique_ptr<std::thread> new_thread(new std::thread([this] { CompressLoop(); }));
+    compress_thread = move(new_thread);
+}
+
+CompressCache::~CompressCache() {
+    {
+        std::lock_guard<std::mutex> locker(mtx);
+        is_close = true;
+    }
+    cond.notify_all();
+    if(compress_thread && compress_thread->joinable()) {
+        compress_thread->join();
+    }
+}
+
+CompressCache* CompressCache::Instance() {
+    static CompressCache cache;
+    return &cache;
+}
+
+void CompressCache::SetBudget(size_t bytes) {
+    std::lock_guard<std::mutex> locker(mtx);
+    budget = bytes;
+    EvictToBudget();
+}
+
+bool CompressCache::SameSource(const Slot& slot, const struct stat& st) {
+    return slot.ino == st.st_ino && slot.size == st.st_size &&
+           slot.mtime.tv_sec == st.st_mtim.tv_sec && slot.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+FileCache::EntryPtr CompressCache::Get(const FileCache::EntryPtr& source) {
+    if(!source || static_cast<size_t>(source->st.st_size) < MIN_LENGTH) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> locker(mtx);
+    auto it = copies.find(source->path);
+    if(it != copies.end()) {
+        if(SameSource(it->second, source->st)) {
+            lru.splice(lru.begin(), lru, it->second.lru_pos);
+            return it->second.entry;
+        }
+        Erase(it);
+    }
+    // Only mapped sources can be compressed, a stat-only one just looks the copy up.
+    if(source->data && queued.count(source->path) == 0 && jobs.size() < MAX_JOBS) {
+        // The job holds the source entry, so its mapping outlives an eviction from the FileCache.
+        queued.insert(source->path);
+        jobs.push_back(source);
+        cond.notify_one();
+    }
+    return nullptr;
+}
+
+FileCache::EntryPtr CompressCache::Compress(const FileCache::Entry& source) {
+    z_stream stream = {};
+    // windowBits 15 + 16 asks zlib for a gzip header and trailer instead of a zlib one.
+    if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nullptr;
+    }
+    size_t bound = deflateBound(&stream, source.len);
+    void* ret = mmap(nullptr, bound, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ret == MAP_FAILED) {
+        deflateEnd(&stream);
+        return nullptr;
+    }
+    char* out = static_cast<char*>(ret);
+
+    stream.next_in = reinterpret_cast<Bytef*>(source.data);
+    stream.avail_in = static_cast<uInt>(source.len);
+    stream.next_out = reinterpret_cast<Bytef*>(out);
+    stream.avail_out = static_cast<uInt>(bound);
+    int res = deflate(&stream, Z_FINISH);
+    size_t len = stream.total_out;
+    deflateEnd(&stream);
+    if(res != Z_STREAM_END || len >= source.len) {
+        munmap(out, bound);
+        return nullptr;
+    }
+
+    // Gives the unused tail of the bound back, the Entry unmaps exactly "len" bytes.
+    void* shrunk = mremap(out, bound, len, 0);
+    if(shrunk == MAP_FAILED) {
+        munmap(out, bound);
+        return nullptr;
+    }
+    mprotect(shrunk, len, PROT_READ);
+
+    std::shared_ptr<FileCache::Entry> entry = std::make_shared<FileCache::Entry>();
+    entry->path = source.path;
+    entry->st = source.st;
+    entry->st.st_size = static_cast<off_t>(len);
+    entry->data = static_cast<char*>(shrunk);
+    entry->len = len;
+    return entry;
+}
+
+void CompressCache::Clear() {
+    std::lock_guard<std::mutex> locker(mtx);
+    copies.clear();
+    lru.clear();
+    bytes = 0;
+}
+
+size_t CompressCache::Bytes() {
+    std::lock_guard<std::mutex> locker(mtx);
+    return bytes;
+}
+
+size_t CompressCache::Count() {
+    std::lock_guard<std::mutex> locker(mtx);
+    return copies.size();
+}
+
+void CompressCache::Erase(std::unordered_map<std::string, Slot>::iterator it) {
+    if(it->second.entry) {
+        bytes -= it->second.entry->len;
+    }
+    lru.erase(it->second.lru_pos);
+    copies.erase(it);
+}
+
+void CompressCache::EvictToBudget() {
+    while((bytes > budget || copies.size() > MAX_COPIES) && !lru.empty()) {
+        Erase(copies.find(lru.back()));
+    }
+}
+
+void CompressCache::CompressLoop() {
+    while(true) {
+        FileCache::EntryPtr source;
+        {
+            std::unique_lock<std::mutex> locker(mtx);
+            cond.wait(locker, [this] { return is_close || !jobs.empty(); });
+            if(is_close) {
+                return;
+            }
+            source = jobs.front();
+            jobs.pop_front();
+        }
+
+        FileCache::EntryPtr entry = Compress(*source);
+
+        std::lock_guard<std::mutex> locker(mtx);
+        queued.erase(source->path);
+        auto it = copies.find(source->path);
+        if(it != copies.end()) {
+            Erase(it);
+        }
+        if(entry && entry->len > budget) {
+            entry.reset();
+        }
+        // A failed or useless compression is remembered too, so the file is not retried
+        // until it changes.
+        lru.push_front(source->path);
+        copies[source->path] = Slot{entry, source->st.st_ino, source->st.st_size, source->st.st_mtim, lru.begin()};
+        if(entry) {
+            bytes += entry->len;
+        }
+        EvictToBudget();
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef WEB_SERVER_HTTP_COMPRESS_CACHE_H
+#define WEB_SERVER_HTTP_COMPRESS_CACHE_H
+
+#include <string>
+#include <list>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "./file_cache.h"
+
+/***************************************************
+ * CompressCache
+ *
+ *   path -> gzip copy of the FileCache entry
+ *
+ *   Get() --miss--> jobs --> compress thread --> copies
+ *
+ * Gzip copies of mapped files, for text assets that have no ".gz"
+ * sibling on disk. Get never compresses: a miss queues the entry for
+ * the compress thread and returns nullptr, so that request goes out
+ * uncompressed and later ones get the copy. A copy is a FileCache
+ * Entry of its own, whose stat is the source's with st_size set to the
+ * compressed length, so a response sends it exactly like a file.
+ * Copies are checked against the source's inode, size and mtime on
+ * every hit, and kept under a byte budget and MAX_COPIES by evicting
+ * from the LRU tail.
+ *
+ ****************************************************/
+
+class CompressCache {
+public:
+    static constexpr size_t DEFAULT_BUDGET = 16 * 1024 * 1024;
+
+    // Smaller files gain nothing from gzip's 20 bytes of framing.
+    static constexpr size_t MIN_LENGTH = 256;
+    static constexpr size_t MAX_JOBS = 64;
+    static constexpr size_t MAX_COPIES = 4096;
+
+    static CompressCache* Instance();
+
+    void SetBudget(size_t bytes);
+
+    // Returns the gzip copy of "source", or nullptr when there is none yet.
+    FileCache::EntryPtr Get(const FileCache::EntryPtr& source);
+
+    void Clear();
+
+    size_t Bytes();
+    size_t Count();
+
+private:
+    struct Slot {
+        // nullptr when gzip did not make the file smaller.
+        FileCache::EntryPtr entry;
+        // Identity of the source the copy was made from.
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        std::list<std::string>::iterator lru_pos;
+    };
+
+    std::unordered_map<std::string, Slot> copies;
+    std::list<std::string> lru;
+    size_t bytes;
+    size_t budget;
+
+    std::deque<FileCache::EntryPtr> jobs;
+    std::unordered_set<std::string> queued;
+    bool is_close;
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::unique_ptr<std::thread> compress_thread;
+
+    CompressCache();
+    ~CompressCache();
+
+    static bool SameSource(const Slot& slot, const struct stat& st);
+    static FileCache::EntryPtr Compress(const FileCache::Entry& source);
+
+    // These expect mtx to be held.
+    void Erase(std::unordered_map<std::string, Slot>::iterator it);
+    void EvictToBudget();
+
+    void CompressLoop();
+};
+
+#endif
@@ -0,0 +1,430 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <dirent.h>
+#include <assert.h>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+#include "./file_cache.h"
+
+namespace {
+
+// Faults a mapping in without reading it byte by byte, Linux 5.14 and later.
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+// Collects world-readable regular files below "dir" as (size, path), symlinks are not followed.
+void WalkDir(const std::string& dir, std::vector<std::pair<size_t, std::string>>& files, int depth) {
+    static const int MAX_DEPTH = 16;
+    DIR* handle = opendir(dir.data());
+    if(!handle) {
+        return;
+    }
+    struct dirent* ent;
+    while((ent = readdir(handle)) != nullptr) {
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        std::string path = dir + "/" + ent->d_name;
+        struct stat st;
+        if(lstat(path.data(), &st) < 0) {
+            continue;
+        }
+        if(S_ISDIR(st.st_mode) && depth < MAX_DEPTH) {
+            WalkDir(path, files, depth + 1);
+        }
+        else if(S_ISREG(st.st_mode) && (st.st_mode & S_IROTH) && st.st_size > 0) {
+            files.emplace_back(static_cast<size_t>(st.st_size), path);
+        }
+    }
+    closedir(handle);
+}
+
+size_t ResidentBytes(const char* data, size_t len) {
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> vec((len + page - 1) / page);
+    if(mincore(const_cast<char*>(data), len, vec.data()) < 0) {
+        return 0;
+    }
+    size_t pages = 0;
+    for(unsigned char v : vec) {
+        pages += v & 1;
+    }
+    return std::min(len, pages * page);
+}
+
+} // namespace
+
+FileCache::Entry::Entry() : st(), data(nullptr), len(0) {}
+
+FileCache::Entry::~Entry() {
+    if(data) {
+        munmap(data, len);
+    }
+}
+
+FileCache::FileCache() : bytes(0), misses(0), budget(DEFAULT_BUDGET), map_limit(DEFAULT_MAP_LIMIT),
+                         inotify_fd(-1), stop_fd(-1), changes(0) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(inotify_fd >= 0 && stop_fd >= 0) {
+        std::unique_ptr<std::thread> new_thread(new std::thread([this] { WatchLoop(); }));
+        watch_thread = move(new_thread);
+    }
+}
+
+FileCache::~FileCache() {
+    if(watch_thread && watch_thread->joinable()) {
+        uint64_t one = 1;
+        ssize_t ret = write(stop_fd, &one, sizeof(one));
+        (void)ret;
+        watch_thread->join();
+    }
+    if(inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+    if(stop_fd >= 0) {
+        close(stop_fd);
+    }
+}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+void FileCache::SetBudget(size_t bytes) {
+    std::lock_guard<std::mutex> locker(mtx);
+    budget = bytes;
+    EvictToBudget();
+}
+
+void FileCache::SetMapLimit(size_t bytes) {
+    map_limit = bytes;
+    Clear();
+}
+
+FileCache::EntryPtr FileCache::Load(const std::string& path, bool map) {
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->path = path;
+    if(stat(path.data(), &entry->st) < 0) {
+        return nullptr;
+    }
+    if(!map || !S_ISREG(entry->st.st_mode) || !(entry->st.st_mode & S_IROTH) || entry->st.st_size == 0 ||
+       static_cast<size_t>(entry->st.st_size) > map_limit) {
+        return entry;
+    }
+
+    int fd = open(path.data(), O_RDONLY);
+    if(fd < 0) {
+        return entry;
+    }
+    void* ret = mmap(nullptr, entry->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ret != MAP_FAILED) {
+        entry->data = static_cast<char*>(ret);
+        entry->len = static_cast<size_t>(entry->st.st_size);
+    }
+    return entry;
+}
+
+FileCache::EntryPtr FileCache::Get(const std::string& path) {
+    bool watched;
+    uint64_t changes_before;
+    {
+        std::lock_guard<std::mutex> locker(mtx);
+        auto it = entries.find(path);
+        if(it != entries.end()) {
+            std::list<std::string>& list = LruOf(it->second);
+            list.splice(list.begin(), list, it->second.lru_pos);
+            return it->second.entry;
+        }
+        // Watched before the load, so a change after it is always seen.
+        watched = Watch(path);
+        changes_before = changes;
+    }
+
+    // The syscalls of a miss run outside the lock.
+    return Insert(path, Load(path, true), watched, changes_before);
+}
+
+FileCache::EntryPtr FileCache::Insert(const std::string& path, const EntryPtr& entry,
+                                      bool watched, uint64_t changes_before) {
+    std::lock_guard<std::mutex> locker(mtx);
+    if(entry && entry->len > budget) {
+        return entry;
+    }
+    auto it = entries.find(path);
+    if(it != entries.end()) {
+        // Another thread loaded it first, keep one copy.
+        return it->second.entry;
+    }
+    // Without a watch nothing would ever tell us the file changed or
+    // appeared, so the result is only used for this request, like Stat's.
+    if(!watched) {
+        return entry;
+    }
+    if(changes != changes_before) {
+        // The event may have been about this file, it could be stale already.
+        return entry;
+    }
+    std::list<std::string>& list = entry ? lru : miss_lru;
+    list.push_front(path);
+    entries[path] = Slot{entry, list.begin()};
+    if(entry) {
+        bytes += entry->len;
+    }
+    else {
+        ++misses;
+    }
+    EvictToBudget();
+    return entry;
+}
+
+FileCache::EntryPtr FileCache::Stat(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> locker(mtx);
+        auto it = entries.find(path);
+        if(it != entries.end()) {
+            std::list<std::string>& list = LruOf(it->second);
+            list.splice(list.begin(), list, it->second.lru_pos);
+            return it->second.entry;
+        }
+    }
+    return Load(path, false);
+}
+
+FileCache::WarmupReport FileCache::Warmup(const std::string& dir, const WarmupOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    WarmupReport report;
+
+    // Keys are spelled the way HttpResponse looks files up, src_dir + "/path",
+    // so "dir" is kept as given, trailing '/' included.
+    std::vector<std::pair<size_t, std::string>> files;
+    if(options.paths.empty()) {
+        WalkDir(dir, files, 0);
+        std::sort(files.begin(), files.end());
+    }
+    else {
+        for(const std::string& path : options.paths) {
+            files.emplace_back(0, dir + (path.empty() || path[0] != '/' ? "/" : "") + path);
+        }
+    }
+
+    size_t max_bytes = options.max_bytes;
+    if(max_bytes == 0) {
+        std::lock_guard<std::mutex> locker(mtx);
+        max_bytes = budget;
+    }
+
+    // Held until the report is done, so nothing warmed is evicted before mincore sees it.
+    std::vector<EntryPtr> warmed;
+    size_t total = 0;
+    for(const auto& file : files) {
+        EntryPtr entry = Get(file.second);
+        if(!entry || !S_ISREG(entry->st.st_mode) || entry->st.st_size == 0) {
+            continue;
+        }
+        size_t len = static_cast<size_t>(entry->st.st_size);
+        if(total + len > max_bytes) {
+            if(options.paths.empty()) {
+                // Sorted by size, nothing after this fits either.
+                break;
+            }
+            continue;
+        }
+        total += len;
+        ++report.files;
+
+        if(!entry->data) {
+            // Above the map limit: sent with sendfile, so only the page cache is warmed.
+            int fd = open(entry->path.data(), O_RDONLY | O_CLOEXEC);
+            if(fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+                report.readahead_bytes += len;
+            }
+            continue;
+        }
+
+        // Huge pages must be asked for before the pages are faulted in.
+        if(options.huge_pages && entry->len >= HUGE_PAGE_SIZE) {
+            madvise(entry->data, entry->len, MADV_HUGEPAGE);
+        }
+        if(madvise(entry->data, entry->len, MADV_POPULATE_READ) < 0) {
+            // Older kernels: start the reads, then touch every page.
+            madvise(entry->data, entry->len, MADV_WILLNEED);
+            const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            volatile char sink = 0;
+            for(size_t i = 0; i < entry->len; i += page) {
+                sink = sink + entry->data[i];
+            }
+        }
+        if(options.lock && mlock(entry->data, entry->len) == 0) {
+            report.locked_bytes += entry->len;
+        }
+        report.mapped_bytes += entry->len;
+        warmed.push_back(entry);
+    }
+
+    for(const EntryPtr& entry : warmed) {
+        report.resident_bytes += ResidentBytes(entry->data, entry->len);
+    }
+    report.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+void FileCache::Invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> locker(mtx);
+    auto it = entries.find(path);
+    if(it != entries.end()) {
+        Erase(it);
+    }
+}
+
+void FileCache::Clear() {
+    std::lock_guard<std::mutex> locker(mtx);
+    EraseAll();
+}
+
+void FileCache::EraseAll() {
+    entries.clear();
+    lru.clear();
+    miss_lru.clear();
+    bytes = 0;
+    misses = 0;
+}
+
+size_t FileCache::Bytes() {
+    std::lock_guard<std::mutex> locker(mtx);
+    return bytes;
+}
+
+size_t FileCache::Count() {
+    std::lock_guard<std::mutex> locker(mtx);
+    return entries.size();
+}
+
+void FileCache::Erase(std::unordered_map<std::string, Slot>::iterator it) {
+    if(it->second.entry) {
+        bytes -= it->second.entry->len;
+    }
+    else {
+        --misses;
+    }
+    LruOf(it->second).erase(it->second.lru_pos);
+    entries.erase(it);
+}
+
+void FileCache::Unwatch(std::unordered_map<int, std::vector<std::string>>::iterator dir) {
+    for(const std::string& spelling : dir->second) {
+        dir_watches.erase(spelling);
+        for(auto it = entries.begin(); it != entries.end();) {
+            const std::string& path = it->first;
+            auto next = std::next(it);
+            if(path.size() > spelling.size() && path.compare(0, spelling.size(), spelling) == 0 &&
+               path[spelling.size()] == '/' && path.find('/', spelling.size() + 1) == std::string::npos) {
+                Erase(it);
+            }
+            it = next;
+        }
+    }
+    watch_dirs.erase(dir);
+}
+
+void FileCache::EvictToBudget() {
+    while(bytes > budget && !lru.empty()) {
+        Erase(entries.find(lru.back()));
+    }
+    // Misses only ever push out other misses.
+    while(misses > MAX_MISSES && !miss_lru.empty()) {
+        Erase(entries.find(miss_lru.back()));
+    }
+}
+
+bool FileCache::Watch(const std::string& path) {
+    if(inotify_fd < 0) {
+        return false;
+    }
+    std::string::size_type idx = path.find_last_of('/');
+    std::string dir = idx == std::string::npos ? "." : path.substr(0, idx);
+    if(dir_watches.count(dir) == 1) {
+        return true;
+    }
+    int wd = inotify_add_watch(inotify_fd, dir.empty() ? "/" : dir.data(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE |
+                               IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                               IN_DELETE_SELF | IN_MOVE_SELF);
+    if(wd < 0) {
+        return false;
+    }
+    dir_watches[dir] = wd;
+    watch_dirs[wd].push_back(dir);
+    return true;
+}
+
+void FileCache::WatchLoop() {
+    alignas(struct inotify_event) char events[4096];
+    struct pollfd fds[2];
+    fds[0].fd = inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fd;
+    fds[1].events = POLLIN;
+
+    while(true) {
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        if(fds[1].revents) {
+            return;
+        }
+
+        ssize_t len;
+        while((len = read(inotify_fd, events, sizeof(events))) > 0) {
+            std::lock_guard<std::mutex> locker(mtx);
+            for(char* p = events; p < events + len;) {
+                struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + event->len;
+
+                if(event->mask & IN_Q_OVERFLOW) {
+                    // Events were lost, any entry may be stale now.
+                    ++changes;
+                    EraseAll();
+                    continue;
+                }
+                auto dir = watch_dirs.find(event->wd);
+                if(dir == watch_dirs.end()) {
+                    continue;
+                }
+                if(event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    // The directory went away or moved, its spellings may
+                    // name another one from now on.
+                    ++changes;
+                    if(event->mask & IN_MOVE_SELF) {
+                        inotify_rm_watch(inotify_fd, event->wd);
+                    }
+                    Unwatch(dir);
+                    continue;
+                }
+                if(event->len == 0) {
+                    continue;
+                }
+                ++changes;
+                for(const std::string& spelling : dir->second) {
+                    auto it = entries.find(spelling + "/" + event->name);
+                    if(it != entries.end()) {
+                        Erase(it);
+                    }
+                }
+            }
+        }
+    }
+}
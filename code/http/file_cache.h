@@ -0,0 +1,164 @@
+#ifndef WEB_SERVER_HTTP_FILE_CACHE_H
+#define WEB_SERVER_HTTP_FILE_CACHE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <sys/stat.h>
+
+/***************************************************
+ * FileCache
+ *
+ *   path -> Entry { stat, mapping }
+ *
+ *   lru:      most recent <-> ... <-> least recent
+ *   miss_lru: most recent <-> ... <-> least recent
+ *
+ * A process-wide cache of stat results and read-only mappings, keyed
+ * by the full path. Entries are reference counted: eviction or
+ * invalidation only drops the cache's reference, a response still
+ * sending the file keeps the mapping alive. Mapped bytes are kept
+ * under a budget by evicting from the LRU tail. An inotify watch on
+ * each directory holding a cached file drops entries whose file
+ * changes, so a hit costs no syscall at all. A file in a directory
+ * that cannot be watched is not cached. Misses are remembered too, as
+ * entries without an Entry, so probing for a file that does not exist
+ * (like a ".gz" sibling) does not stat on every request.
+ * They have an LRU of their own, bounded by MAX_MISSES, so a flood
+ * of requests for missing files never evicts a mapped one.
+ *
+ ****************************************************/
+
+class FileCache {
+public:
+    struct Entry {
+        std::string path;
+        struct stat st;
+
+        // Read-only mapping of the whole file, nullptr for anything that is
+        // not a world-readable regular file, for empty files and for files
+        // above the map limit, which are sent with sendfile instead.
+        char* data;
+        size_t len;
+
+        Entry();
+        ~Entry();
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+    };
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    struct WarmupOptions {
+        // Files to warm, relative to the directory. Empty walks the whole tree,
+        // smallest files first, so the most assets fit.
+        std::vector<std::string> paths;
+
+        // Stops after this many bytes, 0 for the cache budget.
+        size_t max_bytes = 0;
+
+        // Pins mapped files with mlock, bounded by RLIMIT_MEMLOCK.
+        bool lock = false;
+
+        // Asks for transparent huge pages on mappings of at least HUGE_PAGE_SIZE.
+        bool huge_pages = false;
+    };
+
+    struct WarmupReport {
+        size_t files = 0;
+        size_t mapped_bytes = 0;
+        // Mapped bytes found in memory by mincore once warm-up is done.
+        size_t resident_bytes = 0;
+        size_t locked_bytes = 0;
+        // Files above the map limit only get their page cache read ahead.
+        size_t readahead_bytes = 0;
+        double elapsed_ms = 0;
+    };
+
+    static constexpr size_t DEFAULT_BUDGET = 64 * 1024 * 1024;
+    static constexpr size_t DEFAULT_MAP_LIMIT = 4 * 1024 * 1024;
+    static constexpr size_t MAX_MISSES = 4096;
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    static FileCache* Instance();
+
+    // Sets the budget for mapped bytes, evicting at once if needed.
+    void SetBudget(size_t bytes);
+
+    // Files bigger than "bytes" are only stat-ed, never mapped.
+    void SetMapLimit(size_t bytes);
+
+    // Returns the entry for "path", stat-ing and mapping it on a miss.
+    // Returns nullptr when "path" does not exist.
+    EntryPtr Get(const std::string& path);
+
+    // Like Get, but a miss is only stat-ed: the entry returned has no mapping
+    // and is not cached. For requests that may be answered without the body.
+    EntryPtr Stat(const std::string& path);
+
+    // Maps and faults in files under "dir" ahead of the first requests,
+    // for startup. The files land in the cache like any Get, under the keys
+    // HttpResponse uses when "dir" is the src_dir it is given.
+    WarmupReport Warmup(const std::string& dir, const WarmupOptions& options);
+
+    void Invalidate(const std::string& path);
+    void Clear();
+
+    size_t Bytes();
+    // Cached paths, remembered misses included.
+    size_t Count();
+
+private:
+    struct Slot {
+        EntryPtr entry;
+        std::list<std::string>::iterator lru_pos;
+    };
+
+    std::unordered_map<std::string, Slot> entries;
+    std::list<std::string> lru;
+    std::list<std::string> miss_lru;
+    size_t bytes;
+    size_t misses;
+    size_t budget;
+    std::atomic<size_t> map_limit;
+    std::mutex mtx;
+
+    // inotify watch descriptor <-> watched directory. One directory can be
+    // spelled several ways ("a/b", "a//b", a symlink), the kernel gives all
+    // of them the same descriptor, so each descriptor keeps every spelling.
+    int inotify_fd;
+    int stop_fd;
+    std::unordered_map<int, std::vector<std::string>> watch_dirs;
+    std::unordered_map<std::string, int> dir_watches;
+    // Events seen on watched directories, a load that raced one is not cached.
+    uint64_t changes;
+    std::unique_ptr<std::thread> watch_thread;
+
+    FileCache();
+    ~FileCache();
+
+    EntryPtr Load(const std::string& path, bool map);
+
+    // Caches "entry" for "path" unless another thread was first, returns the
+    // cached one. "watched" and "changes_before" are what Watch and "changes"
+    // were before "entry" was loaded.
+    EntryPtr Insert(const std::string& path, const EntryPtr& entry, bool watched, uint64_t changes_before);
+
+    // These expect mtx to be held.
+    std::list<std::string>& LruOf(const Slot& slot) { return slot.entry ? lru : miss_lru; }
+    bool Watch(const std::string& path);
+    void Erase(std::unordered_map<std::string, Slot>::iterator it);
+    void EraseAll();
+    // Forgets a watch the kernel dropped or that no longer watches the
+    // directory under its spellings, with every entry cached there.
+    void Unwatch(std::unordered_map<int, std::vector<std::string>>::iterator dir);
+    void EvictToBudget();
+
+    void WatchLoop();
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * file_cache_warmup_check: checks that files warmed by FileCache::Warmup
+ * are found by HttpResponse without a second load.
+ *
+ *   file_cache_warmup_check
+ *
+ * Builds a small tree in a temporary directory, warms it once with the
+ * src_dir spelled with a trailing '/' and once without, then answers a
+ * request for every file through HttpResponse. Each response must send
+ * the mapping Warmup made and the cache must not grow. A miss exits
+ * with status 1.
+ */
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "./http_response.h"
+
+namespace {
+
+const char* const FILES[] = {
+    "/index.html",
+    "/css/site.css",
+    "/js/app.js",
+    "/images/logo.svg",
+};
+
+bool MakeTree(const std::string& root) {
+    for(const char* sub : {"/css", "/js", "/images"}) {
+        if(mkdir((root + sub).c_str(), 0755) < 0) {
+            return false;
+        }
+    }
+    for(const char* name : FILES) {
+        FILE* fp = fopen((root + name).c_str(), "w");
+        if(!fp) {
+            return false;
+        }
+        fprintf(fp, "contents of %s\n", name);
+        fclose(fp);
+        chmod((root + name).c_str(), 0644);
+    }
+    return true;
+}
+
+void RemoveTree(const std::string& root) {
+    for(const char* name : FILES) {
+        unlink((root + name).c_str());
+    }
+    for(const char* sub : {"/css", "/js", "/images"}) {
+        rmdir((root + sub).c_str());
+    }
+    rmdir(root.c_str());
+}
+
+// Warms "src_dir", walking it or by the list of paths, and serves every file.
+bool Check(const std::string& src_dir, bool by_paths) {
+    FileCache* cache = FileCache::Instance();
+    cache->Clear();
+    FileCache::WarmupOptions options;
+    if(by_paths) {
+        for(const char* name : FILES) {
+            // All but the first without the leading '/', which Warmup accepts too.
+            options.paths.push_back(name == FILES[0] ? name : name + 1);
+        }
+    }
+    FileCache::WarmupReport report = cache->Warmup(src_dir, options);
+    size_t count = cache->Count();
+    bool ok = report.files == sizeof(FILES) / sizeof(FILES[0]);
+
+    for(const char* name : FILES) {
+        FileCache::EntryPtr warmed = cache->Get(src_dir + name);
+        HttpResponse response;
+        Buffer buff;
+        std::string path = name;
+        response.Init(src_dir, path, false);
+        response.MakeResponse(buff);
+        if(response.Code() != 200 || !warmed || response.File() != warmed->data) {
+            fprintf(stderr, "%s%s: not served from the warmed entry\n", src_dir.c_str(), name);
+            ok = false;
+        }
+        response.UnmapFile();
+    }
+    if(cache->Count() != count) {
+        fprintf(stderr, "%s: %zu entries after warm-up, %zu after serving\n", src_dir.c_str(), count,
+                cache->Count());
+        ok = false;
+    }
+    printf("%-40s %-6s %s\n", src_dir.c_str(), by_paths ? "paths" : "walk", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    char dir[] = "/tmp/file_cache_warmup_check.XXXXXX";
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    chmod(dir, 0755);
+    std::string root = dir;
+    if(!MakeTree(root)) {
+        perror(root.c_str());
+        RemoveTree(root);
+        return 1;
+    }
+
+    bool ok = true;
+    for(const std::string& src_dir : {root + "/", root}) {
+        ok = Check(src_dir, false) && ok;
+        ok = Check(src_dir, true) && ok;
+    }
+    FileCache::Instance()->Clear();
+    RemoveTree(root);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+/*
+ * file_send_bench: compares the two body paths of HttpResponse for a
+ * large static file, mmap + writev against sendfile, by throughput
+ * and resident memory.
+ *
+ *   file_send_bench [file MB] [connections] [rounds]
+ *
+ * Creates a file in a temporary directory and has every connection
+ * (a socketpair, drained by a reader thread) send it "rounds" times
+ * through HttpResponse::WriteTo. The map limit of the FileCache picks
+ * the path. Peak VmRSS is sampled every millisecond while sending.
+ */
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./http_response.h"
+
+namespace {
+
+size_t RssBytes() {
+    FILE* fp = fopen("/proc/self/status", "r");
+    if(!fp) {
+        return 0;
+    }
+    char line[256];
+    size_t kb = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        if(strncmp(line, "VmRSS:", 6) == 0) {
+            kb = strtoull(line + 6, nullptr, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb * 1024;
+}
+
+bool MakeFile(const std::string& name, size_t bytes) {
+    FILE* fp = fopen(name.c_str(), "w");
+    if(!fp) {
+        return false;
+    }
+    std::vector<char> chunk(1 << 20);
+    for(size_t i = 0; i < chunk.size(); ++i) {
+        chunk[i] = static_cast<char>('a' + i % 26);
+    }
+    for(size_t left = bytes; left > 0;) {
+        size_t n = std::min(left, chunk.size());
+        fwrite(chunk.data(), 1, n, fp);
+        left -= n;
+    }
+    fclose(fp);
+    chmod(name.c_str(), 0644);
+    return true;
+}
+
+// Sends the file "rounds" times over one connection, returns the bytes sent.
+size_t SendRounds(const std::string& src_dir, int rounds) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        return 0;
+    }
+    std::thread reader([fd = fds[1]] {
+        std::vector<char> sink(256 * 1024);
+        while(read(fd, sink.data(), sink.size()) > 0) {
+        }
+    });
+
+    size_t sent = 0;
+    for(int i = 0; i < rounds; ++i) {
+        HttpResponse response;
+        Buffer buff;
+        std::string path = "/big.bin";
+        response.Init(src_dir, path, true);
+        response.MakeResponse(buff);
+        int err = 0;
+        while(response.BytesToWrite(buff) > 0) {
+            ssize_t len = response.WriteTo(fds[0], buff, &err);
+            if(len < 0) {
+                fprintf(stderr, "WriteTo: %s\n", strerror(err));
+                break;
+            }
+            sent += len;
+        }
+        response.UnmapFile();
+    }
+    close(fds[0]);
+    reader.join();
+    close(fds[1]);
+    return sent;
+}
+
+void Run(const char* mode, const std::string& src_dir, int connections, int rounds) {
+    // Drops whatever the previous mode left cached or mapped.
+    FileCache::Instance()->Clear();
+    size_t rss_before = RssBytes();
+    std::atomic<bool> done(false);
+    std::atomic<size_t> rss_peak(rss_before);
+    std::thread sampler([&] {
+        while(!done) {
+            size_t rss = RssBytes();
+            if(rss > rss_peak) {
+                rss_peak = rss;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    struct rusage usage_before, usage_after;
+    getrusage(RUSAGE_SELF, &usage_before);
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> total(0);
+    std::vector<std::thread> senders;
+    for(int i = 0; i < connections; ++i) {
+        senders.emplace_back([&] { total += SendRounds(src_dir, rounds); });
+    }
+    for(std::thread& sender : senders) {
+        sender.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    getrusage(RUSAGE_SELF, &usage_after);
+    done = true;
+    sampler.join();
+
+    printf("%-9s %10.1f %14.1f %12ld\n", mode, total / seconds / (1 << 20),
+           (rss_peak - rss_before) / double(1 << 20), usage_after.ru_minflt - usage_before.ru_minflt);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t file_mb = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    int connections = argc > 2 ? atoi(argv[2]) : 4;
+    int rounds = argc > 3 ? atoi(argv[3]) : 4;
+    if(file_mb == 0 || connections <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [file MB] [connections] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/file_send_bench.XXXXXX";
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    chmod(dir, 0755);
+    std::string src_dir = std::string(dir) + "/";
+    std::string file = src_dir + "big.bin";
+    if(!MakeFile(file, file_mb << 20)) {
+        perror(file.c_str());
+        return 1;
+    }
+
+    printf("%zu MB file, %d connections x %d rounds\n", file_mb, connections, rounds);
+    printf("%-9s %10s %14s %12s\n", "path", "MB/s", "peak RSS +MB", "minor faults");
+    FileCache* cache = FileCache::Instance();
+    cache->SetBudget(2 * (file_mb << 20));
+    cache->SetMapLimit(SIZE_MAX);
+    Run("mmap", src_dir, connections, rounds);
+    cache->SetMapLimit(0);
+    Run("sendfile", src_dir, connections, rounds);
+
+    unlink(file.c_str());
+    rmdir(dir);
+    return 0;
+}
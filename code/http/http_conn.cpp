@@ -0,0 +1,229 @@
+#include "./http_conn.h"
+
+bool HttpConn::is_et;
+const char* HttpConn::src_dir;
+std::atomic<int> HttpConn::user_count;
+
+HttpConn::HttpConn() {
+    fd = -1;
+    addr = {};
+    is_close = true;
+    is_keep_alive = false;
+}
+
+HttpConn::~HttpConn() {
+    Close();
+}
+
+void HttpConn::Init(int fd, const sockaddr_in& addr) {
+    assert(fd > 0);
+    user_count++;
+    this->addr = addr;
+    this->fd = fd;
+    read_buff.RetrieveAll();
+    write_buff.RetrieveAll();
+    request.Init();
+    while(!pending.empty()) {
+        Recycle();
+    }
+    is_close = false;
+    is_keep_alive = true;
+    LOG_INFO("Client[%d](%s:%d) in, user_count:%d", fd, GetIP(), GetPort(), (int)user_count);
+}
+
+void HttpConn::Close() {
+    while(!pending.empty()) {
+        Recycle();
+    }
+    if(!is_close) {
+        is_close = true;
+        user_count--;
+        close(fd);
+        LOG_INFO("Client[%d](%s:%d) quit, user_count:%d", fd, GetIP(), GetPort(), (int)user_count);
+    }
+}
+
+ssize_t HttpConn::Read(int* saveErrno) {
+    ssize_t len = -1;
+    do {
+        len = read_buff.ReadFd(fd, saveErrno);
+        if(len <= 0) {
+            break;
+        }
+    } while(is_et);
+    return len;
+}
+
+HttpResponse* HttpConn::NextResponse() {
+    std::unique_ptr<HttpResponse> response;
+    if(spare.empty()) {
+        response.reset(new HttpResponse());
+    }
+    else {
+        response = std::move(spare.back());
+        spare.pop_back();
+    }
+    pending.push_back(Pending{std::move(response), 0});
+    return pending.back().response.get();
+}
+
+void HttpConn::Recycle() {
+    // Drops the file the response held, the object itself is reused.
+    pending.front().response->UnmapFile();
+    spare.push_back(std::move(pending.front().response));
+    pending.pop_front();
+}
+
+bool HttpConn::Process() {
+    while(is_keep_alive && pending.size() < MAX_PIPELINE) {
+        HttpRequest::PARSE_RESULT res = request.Parse(read_buff);
+        if(res == HttpRequest::INCOMPLETE) {
+            break;
+        }
+
+        HttpResponse* response = NextResponse();
+        size_t before = write_buff.ReadableBytes();
+        if(res == HttpRequest::BAD_REQUEST) {
+            // The stream cannot be split into requests any more, answer and close.
+            LOG_DEBUG("Client[%d] bad request", fd);
+            std::string path = "/";
+            response->Init(src_dir, path, false, 400);
+            response->MakeResponse(write_buff);
+            pending.back().header_left = write_buff.ReadableBytes() - before;
+            read_buff.RetrieveAll();
+            request.Init();
+            is_keep_alive = false;
+            break;
+        }
+
+        std::string path(request.Path());
+        int code = -1;
+        if(path == "/") {
+            path = "/index.html";
+        }
+        else if(path.find("/../") != std::string::npos ||
+                (path.size() >= 3 && path.compare(path.size() - 3, 3, "/..") == 0)) {
+            code = 400;
+        }
+        LOG_DEBUG("Client[%d] %.*s %s", fd, (int)request.Method().size(), request.Method().data(), path.data());
+
+        // Only GET and HEAD are served, the rest is answered without touching the file.
+        std::string_view method = request.Method();
+        bool is_get = method == "GET";
+        bool is_head = method == "HEAD";
+        if(!is_get && !is_head && code == -1) {
+            code = 501;
+        }
+
+        is_keep_alive = request.IsKeepAlive();
+        response->Init(src_dir, path, is_keep_alive, code);
+        response->SetHeadOnly(is_head);
+        if(is_get || is_head) {
+            response->SetRange(std::string(request.Header("Range")));
+            response->SetIfNoneMatch(std::string(request.Header("If-None-Match")));
+            response->SetIfModifiedSince(std::string(request.Header("If-Modified-Since")));
+        }
+        response->SetAcceptEncoding(std::string(request.Header("Accept-Encoding")));
+        response->MakeResponse(write_buff);
+        pending.back().header_left = write_buff.ReadableBytes() - before;
+        request.Consume(read_buff);
+    }
+    if(!is_keep_alive) {
+        // Nothing after the last request is answered.
+        read_buff.RetrieveAll();
+    }
+    return !pending.empty();
+}
+
+size_t HttpConn::ToWriteBytes() const {
+    size_t len = write_buff.ReadableBytes();
+    for(const Pending& item : pending) {
+        len += item.response->BodyLeft();
+    }
+    return len;
+}
+
+void HttpConn::Advance(size_t len) {
+    while(!pending.empty()) {
+        Pending& front = pending.front();
+        size_t n = std::min(len, front.header_left);
+        write_buff.Retrieve(n);
+        front.header_left -= n;
+        len -= n;
+        if(front.header_left > 0 || front.response->SendsFile()) {
+            // A sendfile body is never part of a gather, Write sends it next.
+            break;
+        }
+        n = std::min(len, front.response->BodyLeft());
+        front.response->BodySent(n);
+        len -= n;
+        if(front.response->BodyLeft() > 0) {
+            break;
+        }
+        Recycle();
+    }
+    assert(len == 0);
+}
+
+ssize_t HttpConn::Write(int* saveErrno) {
+    static const int MAX_IOV = 64;
+    ssize_t total = 0;
+    while(!pending.empty()) {
+        Pending& front = pending.front();
+        if(front.header_left == 0 && front.response->SendsFile()) {
+            ssize_t len = front.response->SendBody(fd, saveErrno);
+            if(len < 0) {
+                return total > 0 ? total : len;
+            }
+            total += len;
+            if(front.response->BodyLeft() > 0) {
+                return total;
+            }
+            Recycle();
+            continue;
+        }
+
+        // Headers and bodies of the queued responses, in order, up to the
+        // first sendfile body or MAX_IOV segments.
+        struct iovec iov[MAX_IOV];
+        int cnt = 0;
+        size_t want = 0;
+        const char* header = write_buff.Peek();
+        for(size_t i = 0; i < pending.size() && cnt < MAX_IOV; ++i) {
+            const Pending& item = pending[i];
+            if(item.header_left > 0) {
+                iov[cnt].iov_base = const_cast<char*>(header);
+                iov[cnt].iov_len = item.header_left;
+                header += item.header_left;
+                ++cnt;
+            }
+            if(item.response->SendsFile()) {
+                break;
+            }
+            cnt += item.response->GatherBody(iov + cnt, MAX_IOV - cnt);
+        }
+        for(int i = 0; i < cnt; ++i) {
+            want += iov[i].iov_len;
+        }
+        if(cnt == 0) {
+            // Only empty bodies are left.
+            Advance(0);
+            continue;
+        }
+
+        ssize_t len = writev(fd, iov, cnt);
+        if(len < 0) {
+            if(total > 0) {
+                return total;
+            }
+            *saveErrno = errno;
+            return len;
+        }
+        Advance(static_cast<size_t>(len));
+        total += len;
+        if(static_cast<size_t>(len) < want) {
+            break;
+        }
+    }
+    return total;
+}
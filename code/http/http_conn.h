@@ -0,0 +1,100 @@
+#ifndef WEB_SERVER_HTTP_HTTP_CONN_H
+#define WEB_SERVER_HTTP_HTTP_CONN_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "../log/log.h"
+#include "../buffer/buffer.h"
+#include "./http_request.h"
+#include "./http_response.h"
+
+/***************************************************
+ * HttpConn
+ *
+ *   read_buff:  |req 1|req 2|req 3|partial req 4...
+ *
+ *   write_buff: |hdr 1|hdr 2|hdr 3|
+ *   pending:    [resp 1, resp 2, resp 3]
+ *
+ *   writev:     hdr 1, body 1, hdr 2, body 2, hdr 3, body 3
+ *
+ * One client connection. Process drains every complete request in
+ * read_buff, pipelined ones included, and queues one HttpResponse per
+ * request. All of their header bytes go into write_buff back to back,
+ * and Write sends headers and mapped bodies interleaved, in request
+ * order, with as few writev calls as the socket allows. A response
+ * whose body is sent with sendfile ends a gather: everything up to
+ * its header goes out with writev, its body follows with sendfile.
+ *
+ ****************************************************/
+
+class HttpConn {
+public:
+    // Responses queued at most. Further requests wait in read_buff
+    // until Write has drained the queue.
+    static constexpr size_t MAX_PIPELINE = 16;
+
+    static bool is_et;
+    static const char* src_dir;
+    static std::atomic<int> user_count;
+
+    HttpConn();
+    ~HttpConn();
+
+    HttpConn(const HttpConn&) = delete;
+    HttpConn& operator=(const HttpConn&) = delete;
+
+    void Init(int fd, const sockaddr_in& addr);
+    void Close();
+
+    ssize_t Read(int* saveErrno);
+    ssize_t Write(int* saveErrno);
+
+    // Turns the complete requests in read_buff into queued responses.
+    // Returns true when there is something to write.
+    bool Process();
+
+    int GetFd() const { return fd; }
+    int GetPort() const { return addr.sin_port; }
+    const char* GetIP() const { return inet_ntoa(addr.sin_addr); }
+    sockaddr_in GetAddr() const { return addr; }
+
+    size_t ToWriteBytes() const;
+
+    // False once a request asked to close, or could not be parsed.
+    bool IsKeepAlive() const { return is_keep_alive; }
+
+private:
+    struct Pending {
+        std::unique_ptr<HttpResponse> response;
+        // Bytes of this response's header still at the front of its share of write_buff.
+        size_t header_left;
+    };
+
+    int fd;
+    struct sockaddr_in addr;
+    bool is_close;
+    bool is_keep_alive;
+
+    Buffer read_buff;
+    Buffer write_buff;
+    HttpRequest request;
+
+    std::deque<Pending> pending;
+    // Finished responses, kept to be reused by the next requests.
+    std::vector<std::unique_ptr<HttpResponse>> spare;
+
+    HttpResponse* NextResponse();
+    void Recycle();
+
+    // Retrieves "len" written bytes from the headers and bodies in order.
+    void Advance(size_t len);
+};
+
+#endif
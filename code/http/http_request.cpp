@@ -0,0 +1,260 @@
+#include <strings.h>
+#include <cctype>
+
+#include "../buffer/buffer_search.h"
+#include "./http_request.h"
+
+namespace {
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+void Trim(std::string_view& str) {
+    while(!str.empty() && (str.front() == ' ' || str.front() == '\t')) str.remove_prefix(1);
+    while(!str.empty() && (str.back() == ' ' || str.back() == '\t')) str.remove_suffix(1);
+}
+
+// RFC 9110 token characters, for methods and header names.
+bool IsToken(std::string_view str) {
+    if(str.empty()) {
+        return false;
+    }
+    for(char c : str) {
+        if(!(isalnum(static_cast<unsigned char>(c)) || (c != '\0' && strchr("!#$%&'*+-.^_`|~", c)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int HexValue(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+HttpRequest::HttpRequest() {
+    Init();
+}
+
+void HttpRequest::Init() {
+    state = REQUEST_LINE;
+    line_start = scanned = 0;
+    base = nullptr;
+    method = path = query = version = body = Span{0, 0};
+    // clear keeps the capacity, a connection's requests reuse the vectors.
+    headers.clear();
+    post.clear();
+    is_http11 = is_keep_alive = has_length = false;
+}
+
+HttpRequest::PARSE_RESULT HttpRequest::Parse(const Buffer& buff) {
+    base = buff.Peek();
+    const size_t readable = buff.ReadableBytes();
+
+    while(state == REQUEST_LINE || state == HEADERS) {
+        const char* crlf = buffer_search::FindCRLF(base + scanned, base + readable);
+        if(crlf == base + readable) {
+            // A trailing '\r' may be the first half of the delimiter, it is searched again.
+            scanned = readable > line_start ? readable - 1 : line_start;
+            return readable > MAX_HEADER_BYTES ? BAD_REQUEST : INCOMPLETE;
+        }
+        size_t begin = line_start;
+        size_t end = crlf - base;
+        line_start = scanned = end + 2;
+        if(line_start > MAX_HEADER_BYTES) {
+            return BAD_REQUEST;
+        }
+
+        if(state == REQUEST_LINE) {
+            // Empty lines before a request are allowed, and skipped.
+            if(begin == end) {
+                continue;
+            }
+            if(!ParseRequestLine(begin, end)) {
+                return BAD_REQUEST;
+            }
+            state = HEADERS;
+        }
+        else if(begin != end) {
+            if(!ParseHeader(begin, end)) {
+                return BAD_REQUEST;
+            }
+        }
+        else {
+            body.offset = line_start;
+            state = body.len > 0 ? BODY : FINISH;
+        }
+    }
+
+    if(state == BODY) {
+        if(readable < body.offset + body.len) {
+            return INCOMPLETE;
+        }
+        ParsePost();
+        state = FINISH;
+    }
+    return COMPLETE;
+}
+
+void HttpRequest::Consume(Buffer& buff) {
+    assert(state == FINISH);
+    buff.Retrieve(Length());
+    Init();
+}
+
+bool HttpRequest::ParseRequestLine(size_t begin, size_t end) {
+    // method SP request-target SP HTTP-version
+    std::string_view line(base + begin, end - begin);
+    std::string_view::size_type sp1 = line.find(' ');
+    if(sp1 == std::string_view::npos) {
+        return false;
+    }
+    std::string_view::size_type sp2 = line.find(' ', sp1 + 1);
+    if(sp2 == std::string_view::npos || line.find(' ', sp2 + 1) != std::string_view::npos) {
+        return false;
+    }
+    std::string_view method_view = line.substr(0, sp1);
+    std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string_view version_view = line.substr(sp2 + 1);
+    if(!IsToken(method_view) || target.empty() || target.front() != '/') {
+        return false;
+    }
+    if(version_view == "HTTP/1.1") {
+        is_http11 = true;
+    }
+    else if(version_view != "HTTP/1.0") {
+        return false;
+    }
+    is_keep_alive = is_http11;
+
+    method = Span{begin, sp1};
+    version = Span{begin + sp2 + 1, version_view.size()};
+    std::string_view::size_type mark = target.find('?');
+    size_t target_offset = begin + sp1 + 1;
+    if(mark == std::string_view::npos) {
+        path = Span{target_offset, target.size()};
+    }
+    else {
+        path = Span{target_offset, mark};
+        query = Span{target_offset + mark + 1, target.size() - mark - 1};
+    }
+    return true;
+}
+
+bool HttpRequest::ParseHeader(size_t begin, size_t end) {
+    // field-name ":" OWS field-value OWS, without obsolete line folding.
+    std::string_view line(base + begin, end - begin);
+    std::string_view::size_type colon = line.find(':');
+    if(colon == std::string_view::npos || headers.size() >= MAX_HEADERS) {
+        return false;
+    }
+    std::string_view name = line.substr(0, colon);
+    if(!IsToken(name)) {
+        return false;
+    }
+    std::string_view value = line.substr(colon + 1);
+    Trim(value);
+    headers.push_back(Field{Span{begin, colon}, Span{static_cast<size_t>(value.data() - base), value.size()}});
+
+    if(EqualsIgnoreCase(name, "Content-Length")) {
+        if(value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string_view::npos) {
+            return false;
+        }
+        size_t len = std::stoull(std::string(value));
+        // Differing lengths would let a proxy and us split the stream differently.
+        if((has_length && len != body.len) || len > MAX_BODY_BYTES) {
+            return false;
+        }
+        has_length = true;
+        body.len = len;
+    }
+    else if(EqualsIgnoreCase(name, "Transfer-Encoding")) {
+        // Chunked request bodies are not supported.
+        return false;
+    }
+    else if(EqualsIgnoreCase(name, "Connection")) {
+        ParseConnection(value);
+    }
+    return true;
+}
+
+void HttpRequest::ParseConnection(std::string_view value) {
+    while(!value.empty()) {
+        std::string_view::size_type comma = value.find(',');
+        std::string_view option = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        Trim(option);
+        if(EqualsIgnoreCase(option, "close")) {
+            is_keep_alive = false;
+        }
+        else if(EqualsIgnoreCase(option, "keep-alive") && !is_http11) {
+            is_keep_alive = true;
+        }
+    }
+}
+
+void HttpRequest::ParsePost() {
+    std::string_view type = Header("Content-Type");
+    type = type.substr(0, type.find(';'));
+    Trim(type);
+    if(Method() != "POST" || !EqualsIgnoreCase(type, "application/x-www-form-urlencoded")) {
+        return;
+    }
+
+    size_t pos = body.offset;
+    const size_t end = body.offset + body.len;
+    while(pos < end) {
+        const char* amp = buffer_search::FindByte(base + pos, base + end, '&');
+        size_t field_end = amp - base;
+        const char* eq = buffer_search::FindByte(base + pos, amp, '=');
+        size_t name_end = eq - base;
+        if(name_end > pos) {
+            size_t value_begin = name_end < field_end ? name_end + 1 : field_end;
+            post.push_back(Field{Span{pos, name_end - pos}, Span{value_begin, field_end - value_begin}});
+        }
+        pos = field_end + 1;
+    }
+}
+
+std::string_view HttpRequest::Header(std::string_view name) const {
+    for(const Field& field : headers) {
+        if(EqualsIgnoreCase(View(field.name), name)) {
+            return View(field.value);
+        }
+    }
+    return std::string_view();
+}
+
+std::string HttpRequest::GetPost(std::string_view key) const {
+    for(const Field& field : post) {
+        std::string_view name = View(field.name);
+        bool encoded = name.find_first_of("%+") != std::string_view::npos;
+        if(encoded ? UrlDecode(name) == key : name == key) {
+            return UrlDecode(View(field.value));
+        }
+    }
+    return std::string();
+}
+
+std::string HttpRequest::UrlDecode(std::string_view str) {
+    std::string res;
+    res.reserve(str.size());
+    for(size_t i = 0; i < str.size(); ++i) {
+        if(str[i] == '+') {
+            res += ' ';
+        }
+        else if(str[i] == '%' && i + 2 < str.size() && HexValue(str[i + 1]) >= 0 && HexValue(str[i + 2]) >= 0) {
+            res += static_cast<char>(HexValue(str[i + 1]) * 16 + HexValue(str[i + 2]));
+            i += 2;
+        }
+        else {
+            res += str[i];
+        }
+    }
+    return res;
+}
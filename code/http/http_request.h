@@ -0,0 +1,124 @@
+#ifndef WEB_SERVER_HTTP_HTTP_REQUEST_H
+#define WEB_SERVER_HTTP_HTTP_REQUEST_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../buffer/buffer.h"
+
+/***************************************************
+ * HttpRequest
+ *
+ *   Buffer: |GET /a?b HTTP/1.1\r\nHost: x\r\n\r\nbody|next request...
+ *            ^read_pos          ^line_start  ^scanned
+ *
+ * An incremental HTTP/1.1 request parser over the readable section of
+ * a Buffer. Nothing is copied: the request line, the headers, the body
+ * and urlencoded POST fields are kept as (offset, length) spans from
+ * Peek(), which stay right when the Buffer grows or compacts, and are
+ * handed out as string_views once the request is complete. Parse can
+ * be called again after every read, it resumes at "scanned" and never
+ * looks at a byte twice. Bytes after the request are left alone, so
+ * pipelined requests are parsed one after another with Consume.
+ *
+ ****************************************************/
+
+class HttpRequest {
+public:
+    enum PARSE_STATE {
+        REQUEST_LINE,
+        HEADERS,
+        BODY,
+        FINISH,
+    };
+
+    enum PARSE_RESULT {
+        INCOMPLETE,
+        COMPLETE,
+        BAD_REQUEST,
+    };
+
+    // Limits that turn a request into BAD_REQUEST.
+    static constexpr size_t MAX_HEADER_BYTES = 16 * 1024;
+    static constexpr size_t MAX_HEADERS = 100;
+    static constexpr size_t MAX_BODY_BYTES = 1024 * 1024;
+
+    HttpRequest();
+
+    void Init();
+
+    // Parses what has arrived in "buff" so far. The views below are valid
+    // after COMPLETE, until "buff" is written to or Consume is called.
+    PARSE_RESULT Parse(const Buffer& buff);
+
+    // Retrieves the complete request from "buff" and gets ready for the next one.
+    void Consume(Buffer& buff);
+
+    PARSE_STATE State() const { return state; }
+
+    // Bytes of the complete request, request line to the end of the body.
+    size_t Length() const { return body.offset + body.len; }
+
+    std::string_view Method() const { return View(method); }
+
+    // The target up to '?', and the query string after it.
+    std::string_view Path() const { return View(path); }
+    std::string_view Query() const { return View(query); }
+    std::string_view Version() const { return View(version); }
+
+    // Returns the value of header "name", compared case-insensitively,
+    // or an empty view when there is no such header.
+    std::string_view Header(std::string_view name) const;
+    std::string_view Body() const { return View(body); }
+
+    bool IsKeepAlive() const { return is_keep_alive; }
+
+    // Returns the decoded value of field "key" of an urlencoded POST body,
+    // empty when there is none. Only this call copies.
+    std::string GetPost(std::string_view key) const;
+
+    // Decodes "%XX" escapes and '+' of an urlencoded string.
+    static std::string UrlDecode(std::string_view str);
+
+private:
+    struct Span {
+        size_t offset;
+        size_t len;
+    };
+
+    struct Field {
+        Span name;
+        Span value;
+    };
+
+    PARSE_STATE state;
+
+    // Start of the line being parsed, and the first byte not yet searched.
+    size_t line_start;
+    size_t scanned;
+
+    // Peek() of the Buffer at the last Parse, the base of every Span.
+    const char* base;
+
+    Span method;
+    Span path;
+    Span query;
+    Span version;
+    std::vector<Field> headers;
+    Span body;
+    std::vector<Field> post;
+
+    bool is_http11;
+    bool is_keep_alive;
+    bool has_length;
+
+    std::string_view View(Span span) const { return std::string_view(base + span.offset, span.len); }
+
+    bool ParseRequestLine(size_t begin, size_t end);
+    bool ParseHeader(size_t begin, size_t end);
+    void ParseConnection(std::string_view value);
+    void ParsePost();
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * http_request_bench: parse throughput of HttpRequest on a pipelined
+ * stream of typical requests, read whole and in small reads.
+ *
+ *   http_request_bench [requests] [read size]
+ *
+ * The stream mixes browser GETs with 0.5 to 4 KB of headers and
+ * urlencoded POSTs. Each pass appends it to a Buffer "read size" bytes
+ * at a time, parsing after every append as HttpConn does after a read,
+ * and consumes each request as it completes.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "./http_request.h"
+
+namespace {
+
+std::string MakeGet(int n, size_t header_bytes) {
+    std::string req = "GET /images/banner_" + std::to_string(n) + ".jpg?width=1280 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "Accept: image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n";
+    for(int i = 0; req.size() + 4 < header_bytes; ++i) {
+        req += "Cookie: session_" + std::to_string(i) + "=" + std::string(64, 'a' + i % 26) + "\r\n";
+    }
+    return req + "\r\n";
+}
+
+std::string MakePost(int n) {
+    std::string body = "username=user" + std::to_string(n) + "&password=p%40ss+word&remember=1";
+    return "POST /login HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+// Parses the whole stream once, returns the number of requests seen.
+size_t Pass(const std::string& stream, size_t read_size, size_t& sum) {
+    HttpRequest request;
+    Buffer buff;
+    size_t requests = 0;
+    for(size_t fed = 0; fed < stream.size();) {
+        size_t len = std::min(read_size, stream.size() - fed);
+        buff.Append(stream.data() + fed, len);
+        fed += len;
+        HttpRequest::PARSE_RESULT result;
+        while((result = request.Parse(buff)) == HttpRequest::COMPLETE) {
+            sum += request.Path().size() + request.Header("host").size() + request.Body().size();
+            request.Consume(buff);
+            ++requests;
+        }
+        if(result == HttpRequest::BAD_REQUEST) {
+            fprintf(stderr, "bad request at byte %zu\n", fed);
+            exit(1);
+        }
+    }
+    return requests;
+}
+
+volatile size_t sink;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 2000;
+    size_t read_size = argc > 2 ? strtoull(argv[2], nullptr, 10) : 0;
+    if(count <= 0) {
+        fprintf(stderr, "usage: %s [requests] [read size]\n", argv[0]);
+        return 1;
+    }
+
+    std::string stream;
+    for(int i = 0; i < count; ++i) {
+        stream += i % 4 == 3 ? MakePost(i) : MakeGet(i, 512 << (i % 4));
+    }
+    printf("%d requests, %zu bytes\n", count, stream.size());
+    printf("%10s %12s %12s\n", "read size", "MB/s", "ns/request");
+
+    const size_t sizes[] = {stream.size(), 64 * 1024, 4096, 512, 64};
+    for(size_t size : sizes) {
+        if(read_size != 0 && size != read_size) {
+            continue;
+        }
+        size_t sum = 0;
+        // Repeats the stream until about 256 MB went through the parser.
+        int passes = static_cast<int>(std::max<size_t>(1, (256u << 20) / stream.size()));
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < passes; ++i) {
+            if(Pass(stream, size, sum) != static_cast<size_t>(count)) {
+                fprintf(stderr, "lost requests at read size %zu\n", size);
+                return 1;
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%10zu %12.1f %12.1f\n", size, stream.size() * passes / seconds / (1 << 20),
+               seconds * 1e9 / (static_cast<double>(count) * passes));
+        sink = sink + sum;
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * http_request_fuzz: fuzz harness for the incremental HttpRequest parser.
+ *
+ *   http_request_fuzz [iterations | input files...]
+ *
+ * Each input is parsed as a stream of pipelined requests twice, once
+ * appended to the Buffer in one piece and once split in chunks of 1 to
+ * 16 bytes, and both runs must see the same requests and end the same
+ * way. Every view handed out must lie inside the readable section.
+ * A failure aborts, so sanitizers and libFuzzer report it with the input.
+ *
+ * Built with -DLIBFUZZER -fsanitize=fuzzer the libFuzzer driver calls
+ * LLVMFuzzerTestOneInput. Without it, main runs the given files, or
+ * mutates a few seed requests for "iterations" rounds.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "./http_request.h"
+
+namespace {
+
+const char* const SEEDS[] = {
+    "GET / HTTP/1.1\r\nHost: x\r\n\r\n",
+    "GET /index.html?a=1&b=%20 HTTP/1.0\r\nConnection: keep-alive\r\n\r\n",
+    "POST /login HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 27\r\n\r\nusername=a+b&password=%41%4",
+    "HEAD /a HTTP/1.1\r\nConnection: close\r\n\r\nGET /b HTTP/1.1\r\n\r\n",
+    "GET /c HTTP/1.1\r\nRange: bytes=0-99\r\nIf-None-Match: \"x\"\r\n\r\n",
+};
+
+void Check(bool ok, const char* what) {
+    if(!ok) {
+        fprintf(stderr, "http_request_fuzz: %s\n", what);
+        abort();
+    }
+}
+
+bool Inside(std::string_view view, const Buffer& buff) {
+    return view.empty() ||
+           (view.data() >= buff.Peek() && view.data() + view.size() <= buff.Peek() + buff.ReadableBytes());
+}
+
+// Parses "data" appended in the sizes of "chunks" (all at once when empty),
+// and returns a transcript of the requests seen and how the stream ended.
+std::string Run(const uint8_t* data, size_t size, const std::vector<size_t>& chunks) {
+    HttpRequest request;
+    Buffer buff;
+    std::string transcript;
+    size_t fed = 0;
+    size_t next = 0;
+    while(true) {
+        HttpRequest::PARSE_RESULT result = request.Parse(buff);
+        if(result == HttpRequest::COMPLETE) {
+            Check(request.State() == HttpRequest::FINISH, "COMPLETE before FINISH");
+            Check(request.Length() <= buff.ReadableBytes(), "request longer than the buffer");
+            Check(Inside(request.Method(), buff) && Inside(request.Path(), buff) &&
+                  Inside(request.Query(), buff) && Inside(request.Version(), buff) &&
+                  Inside(request.Header("Host"), buff) && Inside(request.Body(), buff),
+                  "view outside the buffer");
+            transcript.append(request.Method()).append(" ").append(request.Path());
+            transcript.append("?").append(request.Query()).append(" ").append(request.Version());
+            transcript.append(request.IsKeepAlive() ? " keep-alive " : " close ");
+            transcript.append(request.Body()).append("|").append(request.GetPost("username"));
+            transcript.append("\n");
+            Check(request.Length() > 0, "empty request");
+            request.Consume(buff);
+            continue;
+        }
+        if(result == HttpRequest::BAD_REQUEST) {
+            transcript.append("BAD\n");
+            break;
+        }
+        if(fed == size) {
+            transcript.append("INCOMPLETE\n");
+            break;
+        }
+        size_t len = chunks.empty() ? size - fed : std::min(chunks[next++ % chunks.size()], size - fed);
+        buff.Append(data + fed, len);
+        fed += len;
+    }
+    return transcript;
+}
+
+void OneInput(const uint8_t* data, size_t size) {
+    // Chunk sizes come from the input itself, so a crash reproduces from it.
+    std::vector<size_t> chunks;
+    for(size_t i = 0; i < size && chunks.size() < 64; i += 7) {
+        chunks.push_back(1 + data[i] % 16);
+    }
+    if(chunks.empty()) {
+        chunks.push_back(1);
+    }
+    Check(Run(data, size, {}) == Run(data, size, chunks), "chunked parse differs from whole parse");
+}
+
+// Flips, inserts, deletes or duplicates a few bytes of a seed, or
+// concatenates two seeds.
+std::string Mutate(std::mt19937& rng) {
+    const size_t seeds = sizeof(SEEDS) / sizeof(SEEDS[0]);
+    std::string input = SEEDS[rng() % seeds];
+    if(rng() % 4 == 0) {
+        input += SEEDS[rng() % seeds];
+    }
+    const char alphabet[] = "\r\n :%+=&?/0123456789aAzZ\t";
+    for(int edits = 1 + rng() % 4; edits > 0 && !input.empty(); --edits) {
+        size_t pos = rng() % input.size();
+        switch(rng() % 4) {
+        case 0:
+            input[pos] = static_cast<char>(rng() % 2 ? rng() % 256 : alphabet[rng() % (sizeof(alphabet) - 1)]);
+            break;
+        case 1:
+            input.insert(pos, 1, alphabet[rng() % (sizeof(alphabet) - 1)]);
+            break;
+        case 2:
+            input.erase(pos, 1 + rng() % 8);
+            break;
+        default:
+            input.insert(pos, input.substr(pos, 1 + rng() % 32));
+            break;
+        }
+    }
+    return input;
+}
+
+std::string ReadFile(const char* name) {
+    std::string data;
+    FILE* fp = fopen(name, "rb");
+    if(!fp) {
+        perror(name);
+        exit(1);
+    }
+    char chunk[4096];
+    size_t len;
+    while((len = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        data.append(chunk, len);
+    }
+    fclose(fp);
+    return data;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    OneInput(data, size);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+int main(int argc, char* argv[]) {
+    char* end = nullptr;
+    long iterations = argc > 1 ? strtol(argv[1], &end, 10) : 200000;
+    if(argc > 1 && *end != '\0') {
+        for(int i = 1; i < argc; ++i) {
+            std::string data = ReadFile(argv[i]);
+            OneInput(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+        }
+        printf("%d inputs ok\n", argc - 1);
+        return 0;
+    }
+    if(iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations | input files...]\n", argv[0]);
+        return 1;
+    }
+    std::mt19937 rng(12345);
+    for(long i = 0; i < iterations; ++i) {
+        std::string data = Mutate(rng);
+        OneInput(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    }
+    printf("%ld inputs ok\n", iterations);
+    return 0;
+}
+#endif
@@ -1,32 +1,21 @@
-#include "./http_response.h"
+#include <sys/sendfile.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <strings.h>
+#include <time.h>
 
-const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE = {
-    { ".html",  "text/html" },
-    { ".xml",   "text/xml" },
-    { ".xhtml", "application/xhtml+xml" },
-    { ".txt",   "text/plain" },
-    { ".rtf",   "application/rtf" },
-    { ".pdf",   "application/pdf" },
-    { ".word",  "application/nsword" },
-    { ".png",   "image/png" },
-    { ".gif",   "image/gif" },
-    { ".jpg",   "image/jpeg" },
-    { ".jpeg",  "image/jpeg" },
-    { ".au",    "audio/basic" },
-    { ".mpeg",  "video/mpeg" },
-    { ".mpg",   "video/mpeg" },
-    { ".avi",   "video/x-msvideo" },
-    { ".gz",    "application/x-gzip" },
-    { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
-};
+#include "./http_response.h"
 
 const std::unordered_map<int, std::string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 416, "Range Not Satisfiable" },
+    { 501, "Not Implemented" },
 };
 
 const std::unordered_map<int, std::string> HttpResponse::CODE_PATH = {
@@ -35,12 +24,33 @@ const std::unordered_map<int, std::string> HttpResponse::CODE_PATH = {
     { 404, "/404.html" },
 };
 
+namespace {
+
+// Cache-Control max-age in seconds per MIME_TYPES index.
+std::atomic<long>& MaxAge(size_t mime) {
+    static std::atomic<long> ages[MIME_COUNT];
+    static bool init = [] {
+        for(auto& age : ages) {
+            age.store(-1, std::memory_order_relaxed);
+        }
+        return true;
+    }();
+    (void)init;
+    return ages[mime];
+}
+
+} // namespace
+
 HttpResponse::HttpResponse() {
     code = -1;
     path = src_dir = "";
     is_keep_alive = false;
+    head_only = false;
     mm_file = nullptr;
     mm_file_stat = {0};
+    file_fd = -1;
+    etag_len = last_modified_len = 0;
+    body_index = part_sent = body_left = 0;
 }
 
 HttpResponse::~HttpResponse() {
@@ -49,36 +59,100 @@ HttpResponse::~HttpResponse() {
 
 void HttpResponse::Init(const std::string& src_dir, std::string& path, bool is_keep_alive, int code) {
     assert(src_dir != "");
-    if(mm_file) { UnmapFile(); }
+    UnmapFile();
     this->code = code;
     this->is_keep_alive = is_keep_alive;
+    this->head_only = false;
     this->path = path;
     this->src_dir = src_dir;
     this->mm_file = nullptr;
     this->mm_file_stat = {0};
+    this->file_fd = -1;
+    this->accept_encoding.clear();
+    this->content_encoding = std::string_view();
+    this->if_none_match.clear();
+    this->if_modified_since.clear();
+    this->etag_len = this->last_modified_len = 0;
+    this->range.clear();
+    this->ranges.clear();
+    this->body.clear();
+    this->part_text.clear();
+    this->body_index = this->part_sent = this->body_left = 0;
 }
 
-void HttpResponse::MakeResponse(Buffer& buff) {
-    if(stat((src_dir + path).data(), &mm_file_stat) < 0 || S_ISDIR(mm_file_stat.st_mode)) {
-        code = 404;
+bool HttpResponse::SetMaxAge(std::string_view type, long seconds) {
+    bool found = false;
+    for(size_t i = 0; i < MIME_COUNT; ++i) {
+        if(MIME_TYPES[i].type == type) {
+            MaxAge(i).store(seconds, std::memory_order_relaxed);
+            found = true;
+        }
     }
-    else if(!(mm_file_stat.st_mode & S_IROTH)) {
-        code = 403;
+    return found;
+}
+
+FileCache::EntryPtr HttpResponse::Lookup(const std::string& path) const {
+    return IsConditional() ? FileCache::Instance()->Stat(path) : FileCache::Instance()->Get(path);
+}
+
+void HttpResponse::MakeResponse(Buffer& buff) {
+    // An error code passed to Init, like 400 for a request that could not be
+    // parsed, is answered as is, without looking at the path.
+    if(code < 400) {
+        file_entry = Lookup(src_dir + path);
+        if(file_entry) {
+            mm_file_stat = file_entry->st;
+        }
+
+        if(!file_entry || S_ISDIR(mm_file_stat.st_mode)) {
+            code = 404;
+        }
+        else if(!(mm_file_stat.st_mode & S_IROTH)) {
+            code = 403;
+        }
+        else if(code == -1) {
+            code = 200;
+        }
     }
-    else if(code == -1) {
-        code = 200;
+    if(CODE_STATUS.count(code) == 0) {
+        code = 400;
     }
 
-    ErrorHtml();
-    AddStateLine(buff);
+    if(code >= 400) {
+        AddErrorPage(buff);
+        if(head_only) {
+            DropBody();
+        }
+        return;
+    }
+    if(code == 200 && S_ISREG(mm_file_stat.st_mode)) {
+        // Ranges are served from the identity body only.
+        if(range.empty() && !accept_encoding.empty() && MIME_TYPES[MimeIndex(path)].compressible) {
+            ApplyEncoding();
+        }
+        RenderValidators();
+        if(NotModified()) {
+            code = 304;
+        }
+        else if(!range.empty()) {
+            ApplyRange();
+        }
+    }
     AddHeader(buff);
     AddContent(buff);
+    if(head_only) {
+        DropBody();
+    }
 }
 
 void HttpResponse::UnmapFile() {
-    if(mm_file) {
-        munmap(mm_file, mm_file_stat.st_size);
-        mm_file = nullptr;
+    // The mapping belongs to the FileCache entry, dropping the reference is enough.
+    file_entry.reset();
+    error_pages.reset();
+    mm_file = nullptr;
+    if(file_fd >= 0) {
+        close(file_fd);
+        file_fd = -1;
     }
 }
 
@@ -90,65 +164,640 @@ size_t HttpResponse::FileLen() const {
     return static_cast<size_t>(mm_file_stat.st_size);
 }
 
-void HttpResponse::ErrorHtml() {
-    if(CODE_PATH.count(code) == 1) {
-        path = CODE_PATH.find(code)->second;
-        stat((src_dir + path).data(), &mm_file_stat);
+size_t HttpResponse::BytesToWrite(const Buffer& buff) const {
+    return buff.ReadableBytes() + body_left;
+}
+
+void HttpResponse::AddBodyPart(bool from_file, size_t offset, size_t len) {
+    if(len > 0) {
+        body.push_back(BodyPart{from_file, offset, len});
+        body_left += len;
     }
 }
 
-void HttpResponse::AddStateLine(Buffer& buff) {
-    std::string status;
-    if(CODE_STATUS.count(code) == 1) {
-        status = CODE_STATUS.find(code)->second;
+void HttpResponse::DropBody() {
+    body.clear();
+    part_text.clear();
+    body_left = 0;
+    if(file_fd >= 0) {
+        close(file_fd);
+        file_fd = -1;
+    }
+}
+
+void HttpResponse::BodySent(size_t len) {
+    while(len > 0) {
+        assert(body_index < body.size());
+        size_t n = std::min(len, body[body_index].len - part_sent);
+        part_sent += n;
+        body_left -= n;
+        len -= n;
+        if(part_sent == body[body_index].len) {
+            ++body_index;
+            part_sent = 0;
+        }
+    }
+}
+
+int HttpResponse::GatherBody(struct iovec* iov, int max) const {
+    assert(file_fd < 0);
+    int cnt = 0;
+    for(size_t i = body_index; i < body.size() && cnt < max; ++i) {
+        const BodyPart& part = body[i];
+        const char* base = part.from_file ? mm_file : part_text.data();
+        size_t skip = (i == body_index) ? part_sent : 0;
+        iov[cnt].iov_base = const_cast<char*>(base + part.offset + skip);
+        iov[cnt].iov_len = part.len - skip;
+        ++cnt;
+    }
+    return cnt;
+}
+
+ssize_t HttpResponse::WriteTo(int fd, Buffer& buff, int* saveErrno) {
+    if(file_fd >= 0) {
+        return SendFileTo(fd, buff, saveErrno);
+    }
+
+    static const int MAX_IOV = 64;
+    struct iovec iov[MAX_IOV];
+    int cnt = 0;
+    const size_t header_len = buff.ReadableBytes();
+    if(header_len > 0) {
+        iov[cnt].iov_base = const_cast<char*>(buff.Peek());
+        iov[cnt].iov_len = header_len;
+        ++cnt;
+    }
+    cnt += GatherBody(iov + cnt, MAX_IOV - cnt);
+    if(cnt == 0) {
+        return 0;
+    }
+
+    ssize_t len = writev(fd, iov, cnt);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+
+    // Header bytes go out first, whatever is left belongs to the body.
+    size_t written = static_cast<size_t>(len);
+    if(written <= header_len) {
+        buff.Retrieve(written);
     }
     else {
-        code = 400;
-        status = CODE_STATUS.find(400)->second;
+        buff.Retrieve(header_len);
+        BodySent(written - header_len);
     }
-    buff.Append("HTTP/1.1 " + std::to_string(code) + " " + status + "\r\n");
+    return len;
+}
+
+ssize_t HttpResponse::SendFileTo(int fd, Buffer& buff, int* saveErrno) {
+    ssize_t total = 0;
+    if(buff.ReadableBytes() > 0) {
+        ssize_t len = buff.WriteFd(fd, saveErrno);
+        if(len < 0) {
+            return len;
+        }
+        total += len;
+        if(buff.ReadableBytes() > 0) {
+            return total;
+        }
+    }
+
+    ssize_t len = SendBody(fd, saveErrno);
+    if(len < 0) {
+        return total > 0 ? total : len;
+    }
+    return total + len;
+}
+
+ssize_t HttpResponse::SendBody(int fd, int* saveErrno) {
+    ssize_t total = 0;
+    while(body_index < body.size()) {
+        const BodyPart& part = body[body_index];
+        size_t want = part.len - part_sent;
+        ssize_t len;
+        if(part.from_file && file_fd >= 0) {
+            off_t offset = static_cast<off_t>(part.offset + part_sent);
+            len = sendfile(fd, file_fd, &offset, want);
+            if(len == 0) {
+                // The file shrank after it was stat-ed. The Content-length
+                // promised more, so the connection cannot be reused.
+                errno = EIO;
+                len = -1;
+            }
+        }
+        else {
+            const char* base = part.from_file ? mm_file : part_text.data();
+            len = write(fd, base + part.offset + part_sent, want);
+        }
+
+        if(len < 0) {
+            if(total > 0) {
+                return total;
+            }
+            *saveErrno = errno;
+            return len;
+        }
+        BodySent(len);
+        total += len;
+        if(static_cast<size_t>(len) < want) {
+            break;
+        }
+    }
+    return total;
+}
+
+struct HttpResponse::ErrorPages {
+    struct Page {
+        // "Content-length: n\r\n\r\n", followed by the body.
+        std::string length;
+        std::string body;
+    };
+
+    std::string src_dir;
+    std::unordered_map<int, Page> pages;
+};
+
+std::shared_ptr<const HttpResponse::ErrorPages> HttpResponse::current_error_pages;
+std::atomic<bool> HttpResponse::reload_error_pages(false);
+
+namespace {
+
+// Reads a world-readable regular file into "out", false if that is not possible.
+bool ReadPage(const std::string& path, std::string& out) {
+    int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH)) {
+        close(fd);
+        return false;
+    }
+    out.resize(static_cast<size_t>(st.st_size));
+    size_t done = 0;
+    while(done < out.size()) {
+        ssize_t len = read(fd, &out[done], out.size() - done);
+        if(len < 0 && errno == EINTR) {
+            continue;
+        }
+        if(len <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(len);
+    }
+    close(fd);
+    // The file shrank while it was read.
+    out.resize(done);
+    return true;
+}
+
+} // namespace
+
+std::shared_ptr<const HttpResponse::ErrorPages> HttpResponse::BuildErrorPages(const std::string& src_dir) {
+    std::shared_ptr<ErrorPages> res = std::make_shared<ErrorPages>();
+    res->src_dir = src_dir;
+    for(const auto& status : CODE_STATUS) {
+        if(status.first < 400) {
+            continue;
+        }
+        ErrorPages::Page& page = res->pages[status.first];
+        auto path = CODE_PATH.find(status.first);
+        if(path == CODE_PATH.end() || !ReadPage(src_dir + path->second, page.body)) {
+            page.body = "<html><title>Error</title><body bgcolor=\"ffffff\">" +
+                        std::to_string(status.first) + " : " + status.second + "\n" +
+                        "<hr><em>WebServerCpp</em></body></html>";
+        }
+        page.length = "Content-length: " + std::to_string(page.body.size()) + "\r\n\r\n";
+    }
+    return res;
+}
+
+void HttpResponse::LoadErrorPages(const std::string& src_dir) {
+    reload_error_pages.store(false, std::memory_order_relaxed);
+    std::atomic_store(&current_error_pages, BuildErrorPages(src_dir));
+}
+
+void HttpResponse::ReloadErrorPages() {
+    reload_error_pages.store(true, std::memory_order_relaxed);
+}
+
+void HttpResponse::AddErrorPage(Buffer& buff) {
+    static constexpr size_t MIME_HTML = MimeIndex(".html");
+
+    std::shared_ptr<const ErrorPages> pages = std::atomic_load(&current_error_pages);
+    if(!pages || pages->src_dir != src_dir ||
+       (reload_error_pages.load(std::memory_order_relaxed) && reload_error_pages.exchange(false))) {
+        // First use, or a reload was asked for: one response pays for reading the pages.
+        pages = BuildErrorPages(src_dir);
+        std::atomic_store(&current_error_pages, pages);
+    }
+    auto it = pages->pages.find(code);
+    assert(it != pages->pages.end());
+
+    // The page set outlives the response through error_pages, no copy of the body is made.
+    error_pages = pages;
+    file_entry.reset();
+    mm_file = const_cast<char*>(it->second.body.data());
+    buff.AppendView(HeaderBlock(code, MIME_HTML, is_keep_alive));
+    buff.AppendView(it->second.length);
+    AddBodyPart(true, 0, it->second.body.size());
+}
+
+std::string_view HttpResponse::HeaderBlock(int code, size_t mime, bool keep_alive) {
+    // One block per (code, MIME type, keep-alive), rendered on first use and never changed.
+    // blocks[(code_index * MIME_COUNT + mime) * 2 + keep_alive]
+    static const std::vector<int> codes = [] {
+        std::vector<int> res;
+        for(const auto& status : CODE_STATUS) {
+            res.push_back(status.first);
+        }
+        return res;
+    }();
+    static const std::vector<std::string> blocks = [] {
+        std::vector<std::string> res;
+        for(int status_code : codes) {
+            for(size_t i = 0; i < MIME_COUNT; ++i) {
+                for(int alive = 0; alive < 2; ++alive) {
+                    std::string block = "HTTP/1.1 " + std::to_string(status_code) + " " +
+                                        CODE_STATUS.find(status_code)->second + "\r\n";
+                    block += "Connection: ";
+                    block += alive ? "keep-alive\r\nkeep-alive: max=6, timeout=120\r\n" : "close\r\n";
+                    if(status_code != 304) {
+                        block += "Content-type: ";
+                        block += MIME_TYPES[i].type;
+                        block += "\r\n";
+                    }
+                    res.push_back(std::move(block));
+                }
+            }
+        }
+        return res;
+    }();
+
+    size_t index = 0;
+    while(index < codes.size() && codes[index] != code) {
+        ++index;
+    }
+    assert(index < codes.size() && mime < MIME_COUNT);
+    return blocks[(index * MIME_COUNT + mime) * 2 + (keep_alive ? 1 : 0)];
 }
 
 void HttpResponse::AddHeader(Buffer& buff) {
-    buff.Append("Connection: ");
-    if(is_keep_alive) {
-        buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
+    size_t mime = (code == 206 && ranges.size() > 1) ? MIME_BYTERANGES : MimeIndex(path);
+    buff.AppendView(HeaderBlock(code, mime, is_keep_alive));
+}
+
+void HttpResponse::ApplyRange() {
+    // Caps the number of windows, so a hostile header cannot blow up the response.
+    static const size_t MAX_RANGES = 16;
+    const size_t size = FileLen();
+
+    std::string_view spec(range);
+    if(spec.substr(0, 6) != "bytes=") {
+        return;
+    }
+    spec.remove_prefix(6);
+
+    std::vector<std::pair<size_t, size_t>> res;
+    bool any = false;
+    while(!spec.empty()) {
+        std::string_view::size_type comma = spec.find(',');
+        std::string_view item = spec.substr(0, comma);
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+
+        while(!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while(!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        if(item.empty()) {
+            continue;
+        }
+        std::string_view::size_type dash = item.find('-');
+        if(dash == std::string_view::npos) {
+            return;
+        }
+        std::string_view first = item.substr(0, dash);
+        std::string_view last = item.substr(dash + 1);
+        if(first.size() > 18 || last.size() > 18 || (first.empty() && last.empty()) ||
+           first.find_first_not_of("0123456789") != std::string_view::npos ||
+           last.find_first_not_of("0123456789") != std::string_view::npos) {
+            return;
+        }
+        any = true;
+
+        size_t start, end;
+        if(first.empty()) {
+            // "-n": the last n bytes.
+            size_t n = std::stoull(std::string(last));
+            if(n == 0 || size == 0) {
+                continue;
+            }
+            start = n >= size ? 0 : size - n;
+            end = size - 1;
+        }
+        else {
+            start = std::stoull(std::string(first));
+            end = last.empty() ? size - 1 : std::stoull(std::string(last));
+            if(end < start) {
+                return;
+            }
+            if(start >= size) {
+                continue;
+            }
+            end = std::min(end, size - 1);
+        }
+        res.emplace_back(start, end - start + 1);
+        if(res.size() > MAX_RANGES) {
+            return;
+        }
+    }
+    if(!any) {
+        return;
+    }
+
+    if(res.empty()) {
+        code = 416;
     }
     else {
-        buff.Append("close\r\n");
+        code = 206;
+        ranges = std::move(res);
     }
-    buff.Append("AddContent-type: " + GetFileType() + "\r\n");
 }
 
-void HttpResponse::AddContent(Buffer& buff) {
-    int src_fd = open((src_dir + path).data(), O_RDONLY);
-    if(src_fd < 0) {
-        ErrorContent(buff, "File NotFound!");
+void HttpResponse::AddRangeContent(Buffer& buff) {
+    if(code == 416) {
+        buff.AppendView("Content-Range: bytes */");
+        buff.AppendUInt(FileLen());
+        buff.AppendView("\r\nContent-length: 0\r\n\r\n");
         return;
     }
 
-    LOG_DEBUG("file path %s", (src_dir + path).data());
-    char* mm_ret = (char*)mmap(0, mm_file_stat.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
-    if(*mm_ret == -1) {
-        ErrorContent(buff, "File NotFound!");
+    if(ranges.size() == 1) {
+        buff.AppendView("Content-Range: bytes ");
+        buff.AppendUInt(ranges[0].first);
+        buff.AppendView("-");
+        buff.AppendUInt(ranges[0].first + ranges[0].second - 1);
+        buff.AppendView("/");
+        buff.AppendUInt(FileLen());
+        buff.AppendView("\r\nContent-length: ");
+        buff.AppendUInt(ranges[0].second);
+        buff.AppendView("\r\n\r\n");
+        AddBodyPart(true, ranges[0].first, ranges[0].second);
         return;
     }
-    mm_file = mm_ret;
-    close(src_fd);
-    buff.Append("Content-length: " + std::to_string(mm_file_stat.st_size) + "\r\n\r\n");
+
+    // multipart/byteranges: every window is preceded by its own part header,
+    // the part headers live in part_text and are sent between the windows.
+    std::string_view type = MIME_TYPES[MimeIndex(path)].type;
+    std::vector<std::pair<size_t, size_t>> delimiters;
+    for(const auto& window : ranges) {
+        size_t begin = part_text.size();
+        part_text += "\r\n--";
+        part_text += BYTERANGES_BOUNDARY;
+        part_text += "\r\nContent-type: ";
+        part_text += type;
+        part_text += "\r\nContent-Range: bytes ";
+        part_text += std::to_string(window.first) + "-" + std::to_string(window.first + window.second - 1);
+        part_text += "/" + std::to_string(FileLen()) + "\r\n\r\n";
+        delimiters.emplace_back(begin, part_text.size() - begin);
+    }
+    size_t begin = part_text.size();
+    part_text += "\r\n--";
+    part_text += BYTERANGES_BOUNDARY;
+    part_text += "--\r\n";
+
+    for(size_t i = 0; i < ranges.size(); ++i) {
+        AddBodyPart(false, delimiters[i].first, delimiters[i].second);
+        AddBodyPart(true, ranges[i].first, ranges[i].second);
+    }
+    AddBodyPart(false, begin, part_text.size() - begin);
+
+    buff.AppendView("Content-length: ");
+    buff.AppendUInt(body_left);
+    buff.AppendView("\r\n\r\n");
+}
+
+unsigned HttpResponse::AcceptedEncodings(std::string_view value) {
+    unsigned accepted = 0;
+    unsigned refused = 0;
+    bool wildcard = false;
+    while(!value.empty()) {
+        std::string_view::size_type comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+
+        std::string_view::size_type semi = item.find(';');
+        std::string_view name = item.substr(0, semi);
+        std::string_view params = semi == std::string_view::npos ? std::string_view() : item.substr(semi + 1);
+        while(!name.empty() && name.front() == ' ') name.remove_prefix(1);
+        while(!name.empty() && name.back() == ' ') name.remove_suffix(1);
+
+        // "q=0", "q=0.0" and so on refuse the coding, any other weight accepts it.
+        bool zero = false;
+        std::string_view::size_type q = params.find("q=");
+        if(q != std::string_view::npos) {
+            std::string_view weight = params.substr(q + 2);
+            weight = weight.substr(0, weight.find_first_of(" ;"));
+            zero = !weight.empty() && weight[0] == '0' &&
+                   weight.find_first_not_of("0.") == std::string_view::npos;
+        }
+
+        unsigned coding = 0;
+        if((name.size() == 4 && strncasecmp(name.data(), "gzip", 4) == 0) ||
+           (name.size() == 6 && strncasecmp(name.data(), "x-gzip", 6) == 0)) {
+            coding = ENCODING_GZIP;
+        }
+        else if(name.size() == 2 && strncasecmp(name.data(), "br", 2) == 0) {
+            coding = ENCODING_BR;
+        }
+        else if(name == "*") {
+            wildcard = !zero;
+            continue;
+        }
+        if(zero) {
+            refused |= coding;
+        }
+        else {
+            accepted |= coding;
+        }
+    }
+    if(wildcard) {
+        accepted |= (ENCODING_GZIP | ENCODING_BR) & ~refused;
+    }
+    return accepted & ~refused;
 }
 
-std::string HttpResponse::GetFileType() {
-    std::string::size_type idx = path.find_last_of('.');
-    if(idx == std::string::npos) {
-        return "text/plain";
+void HttpResponse::ApplyEncoding() {
+    static const struct {
+        unsigned coding;
+        std::string_view suffix;
+        std::string_view name;
+    } SIBLINGS[] = {
+        { ENCODING_BR,   ".br", "br" },
+        { ENCODING_GZIP, ".gz", "gzip" },
+    };
+
+    unsigned accepted = AcceptedEncodings(accept_encoding);
+    if(accepted == 0) {
+        return;
+    }
+    const struct stat& st = file_entry->st;
+    for(const auto& sibling : SIBLINGS) {
+        if(!(accepted & sibling.coding)) {
+            continue;
+        }
+        FileCache::EntryPtr entry = Lookup(file_entry->path + std::string(sibling.suffix));
+        if(!entry || !S_ISREG(entry->st.st_mode) || !(entry->st.st_mode & S_IROTH)) {
+            continue;
+        }
+        // A sibling older than the file itself is stale, the identity body is sent instead.
+        if(entry->st.st_mtim.tv_sec < st.st_mtim.tv_sec ||
+           (entry->st.st_mtim.tv_sec == st.st_mtim.tv_sec && entry->st.st_mtim.tv_nsec < st.st_mtim.tv_nsec)) {
+            continue;
+        }
+        file_entry = entry;
+        mm_file_stat = entry->st;
+        content_encoding = sibling.name;
+        return;
     }
-    std::string suffix = path.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+
+    // Without a sibling, a copy made by the CompressCache in the background.
+    if(accepted & ENCODING_GZIP) {
+        FileCache::EntryPtr entry = CompressCache::Instance()->Get(file_entry);
+        if(entry) {
+            file_entry = entry;
+            mm_file_stat = entry->st;
+            content_encoding = "gzip";
+        }
     }
-    return "text/plain";
+}
+
+void HttpResponse::RenderValidators() {
+    // Strong ETag: inode, size and mtime in hex. A compressed copy differs from the
+    // file in size and a sibling in inode, so every body gets its own tag.
+    const struct stat& st = mm_file_stat;
+    unsigned long long mtime = static_cast<unsigned long long>(st.st_mtim.tv_sec) * 1000000000ULL +
+                               static_cast<unsigned long long>(st.st_mtim.tv_nsec);
+    char* p = etag;
+    char* end = etag + sizeof(etag);
+    *p++ = '"';
+    p = std::to_chars(p, end, static_cast<unsigned long long>(st.st_ino), 16).ptr;
+    *p++ = '-';
+    p = std::to_chars(p, end, static_cast<unsigned long long>(st.st_size), 16).ptr;
+    *p++ = '-';
+    p = std::to_chars(p, end, mtime, 16).ptr;
+    *p++ = '"';
+    etag_len = p - etag;
+
+    struct tm tm;
+    gmtime_r(&st.st_mtim.tv_sec, &tm);
+    last_modified_len = strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+bool HttpResponse::NotModified() const {
+    std::string_view tag(etag, etag_len);
+    if(!if_none_match.empty()) {
+        // If-None-Match wins over If-Modified-Since, and compares weakly.
+        std::string_view list(if_none_match);
+        while(!list.empty()) {
+            std::string_view::size_type comma = list.find(',');
+            std::string_view item = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            while(!item.empty() && item.front() == ' ') item.remove_prefix(1);
+            while(!item.empty() && item.back() == ' ') item.remove_suffix(1);
+            if(item.substr(0, 2) == "W/") {
+                item.remove_prefix(2);
+            }
+            if(item == "*" || item == tag) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if(if_modified_since.empty()) {
+        return false;
+    }
+    // Clients usually echo our own Last-Modified, which spares the parse.
+    if(if_modified_since == std::string_view(last_modified, last_modified_len)) {
+        return true;
+    }
+    struct tm tm = {};
+    const char* end = strptime(if_modified_since.data(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || *end != '\0') {
+        return false;
+    }
+    return mm_file_stat.st_mtim.tv_sec <= timegm(&tm);
+}
+
+void HttpResponse::AddValidators(Buffer& buff) {
+    size_t mime = MimeIndex(path);
+    if(MIME_TYPES[mime].compressible) {
+        buff.AppendView("Vary: Accept-Encoding\r\n");
+    }
+    if(etag_len == 0) {
+        return;
+    }
+    buff.AppendView("ETag: ");
+    buff.AppendView(std::string_view(etag, etag_len));
+    buff.AppendView("\r\nLast-Modified: ");
+    buff.AppendView(std::string_view(last_modified, last_modified_len));
+    buff.AppendView("\r\n");
+    long age = MaxAge(mime).load(std::memory_order_relaxed);
+    if(age >= 0) {
+        buff.AppendView("Cache-Control: max-age=");
+        buff.AppendInt(age);
+        buff.AppendView("\r\n");
+    }
+}
+
+void HttpResponse::AddContent(Buffer& buff) {
+    if(!file_entry || !S_ISREG(file_entry->st.st_mode)) {
+        ErrorContent(buff, "File NotFound!");
+        return;
+    }
+    if(code == 416) {
+        AddRangeContent(buff);
+        return;
+    }
+    if(code == 304) {
+        // Header only, the file is neither opened nor mapped.
+        AddValidators(buff);
+        buff.AppendView("\r\n");
+        return;
+    }
+
+    LOG_DEBUG("file path %s", file_entry->path.data());
+    if(!file_entry->data && file_entry->st.st_size > 0 && !head_only) {
+        // Not mapped by the cache (too large), the body goes out with sendfile.
+        file_fd = open(file_entry->path.data(), O_RDONLY | O_CLOEXEC);
+        if(file_fd < 0) {
+            ErrorContent(buff, "File NotFound!");
+            return;
+        }
+    }
+    mm_file = file_entry->data;
+    AddValidators(buff);
+    if(!content_encoding.empty()) {
+        // Ranges would address the identity body, so they are not offered for an encoded one.
+        buff.AppendView("Content-Encoding: ");
+        buff.AppendView(content_encoding);
+        buff.AppendView("\r\n");
+    }
+    else {
+        buff.AppendView("Accept-Ranges: bytes\r\n");
+    }
+    if(code == 206) {
+        AddRangeContent(buff);
+        return;
+    }
+    buff.AppendView("Content-length: ");
+    buff.AppendUInt(FileLen());
+    buff.AppendView("\r\n\r\n");
+    AddBodyPart(true, 0, FileLen());
+}
+
+std::string_view HttpResponse::GetFileType() const {
+    return MIME_TYPES[MimeIndex(path)].type;
 }
 
 void HttpResponse::ErrorContent(Buffer& buff, std::string message) {
@@ -166,6 +815,10 @@ void HttpResponse::ErrorContent(Buffer& buff, std::string message) {
     body += "<p>" + message + "</p>";
     body += "<hr><em>WebServerCpp</em></body></html>";
 
-    buff.Append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
+    buff.AppendView("Content-length: ");
+    buff.AppendUInt(body.size());
+    buff.AppendView("\r\n\r\n");
+    if(!head_only) {
+        buff.Append(body);
+    }
 }
@@ -3,48 +3,185 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "../log/log.h"
 #include "../buffer/buffer.h"
+#include "./file_cache.h"
+#include "./compress_cache.h"
+#include "./mime_type.h"
 
 class HttpResponse {
 private:
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
+    enum {
+        ENCODING_GZIP = 1,
+        ENCODING_BR = 2,
+    };
+
     static const std::unordered_map<int, std::string> CODE_STATUS;
     static const std::unordered_map<int, std::string> CODE_PATH;
 
+    // Error bodies for every error code in CODE_STATUS, read once from CODE_PATH
+    // or generated, and never changed: a reload builds a new set.
+    struct ErrorPages;
+    static std::shared_ptr<const ErrorPages> current_error_pages;
+    static std::atomic<bool> reload_error_pages;
+    std::shared_ptr<const ErrorPages> error_pages;
+
     int code;
     bool is_keep_alive;
+    // A HEAD request: the header is the one of a GET, nothing follows it.
+    bool head_only;
 
     std::string path;
     std::string src_dir;
 
+    // mm_file points into file_entry, which keeps the shared mapping alive.
+    FileCache::EntryPtr file_entry;
     char* mm_file;
     struct stat mm_file_stat;
 
+    // Files the FileCache did not map are sent from file_fd with sendfile.
+    int file_fd;
+
+    // Value of the request's Range header, empty when there is none.
+    std::string range;
+
+    // Value of the request's Accept-Encoding header, and the coding picked for
+    // the body, empty for identity.
+    std::string accept_encoding;
+    std::string_view content_encoding;
+
+    // Values of the request's If-None-Match and If-Modified-Since headers.
+    std::string if_none_match;
+    std::string if_modified_since;
+
+    // Validators of the body being sent, empty until RenderValidators.
+    char etag[64];
+    size_t etag_len;
+    char last_modified[32];
+    size_t last_modified_len;
+
+    // Requested windows of the file as (offset, length), set for 206 responses.
+    std::vector<std::pair<size_t, size_t>> ranges;
+
+    // The body follows the header bytes as a list of parts: windows of the
+    // file, and for multi-range responses the delimiter lines in part_text.
+    struct BodyPart {
+        bool from_file;
+        size_t offset;
+        size_t len;
+    };
+    std::vector<BodyPart> body;
+    std::string part_text;
+
+    // Send progress: first unfinished part, bytes of it already sent, bytes left.
+    size_t body_index;
+    size_t part_sent;
+    size_t body_left;
+
 public:
     HttpResponse();
     ~HttpResponse();
 
     void Init(const std::string& src_dir, std::string& path, bool is_keep_alive = false, int code = -1);
     void MakeResponse(Buffer& buff);
+
+    // Passes the value of the request's Range header, call between Init and MakeResponse.
+    void SetRange(const std::string& range) { this->range = range; }
+    void SetAcceptEncoding(const std::string& value) { accept_encoding = value; }
+    void SetIfNoneMatch(const std::string& value) { if_none_match = value; }
+    void SetIfModifiedSince(const std::string& value) { if_modified_since = value; }
+    void SetHeadOnly(bool value) { head_only = value; }
+
+    // Sets the Cache-Control max-age sent for every suffix of MIME "type", a negative
+    // value sends no Cache-Control, which is the default. False for an unknown type.
+    static bool SetMaxAge(std::string_view type, long seconds);
+
+    // Reads the error pages from "src_dir", at startup. Without it they are
+    // read on the first error response.
+    static void LoadErrorPages(const std::string& src_dir);
+
+    // Has the next error response read the pages again. Only sets a flag,
+    // so it can be called from a signal handler.
+    static void ReloadErrorPages();
+
     void UnmapFile();
     char* File();
+    int FileFd() const { return file_fd; }
     size_t FileLen() const;
     void ErrorContent(Buffer& buff, std::string message);
+
+    // Sends the header bytes in "buff" and the body parts with one writev.
+    // Large files are not mapped: the headers are written first and the body follows
+    // with sendfile from FileFd(). Progress is kept across EAGAIN, so the call can
+    // simply be repeated.
+    ssize_t WriteTo(int fd, Buffer& buff, int* saveErrno);
+
+    // Returns the bytes WriteTo still has to send.
+    size_t BytesToWrite(const Buffer& buff) const;
     int Code() const { return code; }
 
+    /*
+     * Body-only sending, for callers that write the header bytes themselves,
+     * like HttpConn gathering several pipelined responses into one writev.
+     *
+     * GatherBody fills at most "max" iovecs with the unsent body and returns
+     * how many, it is only usable when SendsFile() is false. BodySent marks
+     * "len" body bytes as written. SendBody writes the body itself, with
+     * sendfile when SendsFile() is true. A file that shrank below the
+     * Content-length fails with EIO: the connection must be closed.
+     */
+    bool SendsFile() const { return file_fd >= 0; }
+    size_t BodyLeft() const { return body_left; }
+    int GatherBody(struct iovec* iov, int max) const;
+    void BodySent(size_t len);
+    ssize_t SendBody(int fd, int* saveErrno);
+
 private:
-    void AddStateLine(Buffer& buff);
+    // Appends the pre-rendered status line and static headers.
     void AddHeader(Buffer& buff);
     void AddContent(Buffer& buff);
 
-    void ErrorHtml();
-    std::string GetFileType();
+    ssize_t SendFileTo(int fd, Buffer& buff, int* saveErrno);
+
+    void AddBodyPart(bool from_file, size_t offset, size_t len);
+    // Forgets the body once its length is in the header, for head_only.
+    void DropBody();
+
+    // Parses "range" against the file size: fills "ranges" and turns code 200
+    // into 206, or into 416 when nothing is satisfiable. A malformed header is ignored.
+    void ApplyRange();
+    void AddRangeContent(Buffer& buff);
+
+    // Swaps file_entry for a ".br" or ".gz" sibling, or for the CompressCache copy,
+    // when "accept_encoding" allows it.
+    void ApplyEncoding();
+    static unsigned AcceptedEncodings(std::string_view value);
+
+    // Conditional requests only stat files they have not seen, a 304 never maps one.
+    bool IsConditional() const { return !if_none_match.empty() || !if_modified_since.empty(); }
+    FileCache::EntryPtr Lookup(const std::string& path) const;
+
+    // Fills etag and last_modified from mm_file_stat.
+    void RenderValidators();
+    bool NotModified() const;
+    void AddValidators(Buffer& buff);
+
+    // Appends the header block and points the body at the in-memory error page.
+    void AddErrorPage(Buffer& buff);
+    static std::shared_ptr<const ErrorPages> BuildErrorPages(const std::string& src_dir);
+    std::string_view GetFileType() const;
+
+    static std::string_view HeaderBlock(int code, size_t mime, bool keep_alive);
 };
 
 #endif
@@ -0,0 +1,103 @@
+#ifndef WEB_SERVER_HTTP_MIME_TYPE_H
+#define WEB_SERVER_HTTP_MIME_TYPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <string_view>
+
+/***************************************************
+ * Suffix -> MIME type lookup.
+ *
+ * MIME_TYPES is hashed into MIME_SLOTS at compile time. The hash is
+ * perfect for the table below: every suffix gets its own slot, which
+ * a static_assert checks, so a lookup is one hash, one slot read and
+ * one compare. Entry 0 is the default for unknown suffixes. Entries
+ * without a suffix are never looked up by path, they are picked by
+ * index, like MIME_BYTERANGES for multi-range responses.
+ *
+ ****************************************************/
+
+struct MimeType {
+    std::string_view suffix;
+    std::string_view type;
+    // Worth sending with a Content-Encoding, see CompressCache.
+    bool compressible;
+};
+
+constexpr MimeType MIME_TYPES[] = {
+    { "",       "text/plain",            false },
+    { ".html",  "text/html",             true },
+    { ".xml",   "text/xml",              true },
+    { ".xhtml", "application/xhtml+xml", true },
+    { ".txt",   "text/plain",            true },
+    { ".rtf",   "application/rtf",       false },
+    { ".pdf",   "application/pdf",       false },
+    { ".word",  "application/nsword",    false },
+    { ".png",   "image/png",             false },
+    { ".gif",   "image/gif",             false },
+    { ".jpg",   "image/jpeg",            false },
+    { ".jpeg",  "image/jpeg",            false },
+    { ".au",    "audio/basic",           false },
+    { ".mpeg",  "video/mpeg",            false },
+    { ".mpg",   "video/mpeg",            false },
+    { ".avi",   "video/x-msvideo",       false },
+    { ".gz",    "application/x-gzip",    false },
+    { ".tar",   "application/x-tar",     false },
+    { ".css",   "text/css",              true },
+    { ".js",    "text/javascript",       true },
+    { "",       "multipart/byteranges; boundary=3d6b6a416f9b5c1e", false },
+};
+
+constexpr std::string_view BYTERANGES_BOUNDARY = "3d6b6a416f9b5c1e";
+
+constexpr size_t MIME_COUNT = sizeof(MIME_TYPES) / sizeof(MIME_TYPES[0]);
+constexpr size_t MIME_SLOT_COUNT = 64;
+constexpr size_t MIME_BYTERANGES = MIME_COUNT - 1;
+
+static_assert(MIME_TYPES[MIME_BYTERANGES].type.substr(MIME_TYPES[MIME_BYTERANGES].type.size() -
+                                                      BYTERANGES_BOUNDARY.size()) == BYTERANGES_BOUNDARY,
+              "MIME_BYTERANGES must announce BYTERANGES_BOUNDARY");
+
+// "suffix" includes the leading '.', so it is at least 2 bytes long when hashed.
+constexpr size_t MimeHash(std::string_view suffix) {
+    return (suffix.size() + static_cast<unsigned char>(suffix[1]) * 9 +
+            static_cast<unsigned char>(suffix.back())) % MIME_SLOT_COUNT;
+}
+
+// Slot -> index into MIME_TYPES, 0 for an empty slot.
+constexpr std::array<uint8_t, MIME_SLOT_COUNT> BuildMimeSlots() {
+    std::array<uint8_t, MIME_SLOT_COUNT> slots = {};
+    for(size_t i = 1; i < MIME_COUNT; ++i) {
+        if(!MIME_TYPES[i].suffix.empty()) {
+            slots[MimeHash(MIME_TYPES[i].suffix)] = static_cast<uint8_t>(i);
+        }
+    }
+    return slots;
+}
+
+constexpr std::array<uint8_t, MIME_SLOT_COUNT> MIME_SLOTS = BuildMimeSlots();
+
+constexpr bool MimeHashIsPerfect() {
+    for(size_t i = 1; i < MIME_COUNT; ++i) {
+        if(!MIME_TYPES[i].suffix.empty() && MIME_SLOTS[MimeHash(MIME_TYPES[i].suffix)] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(MimeHashIsPerfect(), "MimeHash collides, pick new multipliers for MIME_TYPES");
+
+// Returns the MIME_TYPES index for "path", judged by its suffix.
+constexpr size_t MimeIndex(std::string_view path) {
+    std::string_view::size_type idx = path.find_last_of('.');
+    if(idx == std::string_view::npos || path.size() - idx < 2) {
+        return 0;
+    }
+    std::string_view suffix = path.substr(idx);
+    size_t i = MIME_SLOTS[MimeHash(suffix)];
+    return MIME_TYPES[i].suffix == suffix ? i : 0;
+}
+
+#endif
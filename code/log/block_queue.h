@@ -2,57 +2,447 @@
 #define WEB_SERVER_LOG_BLOCK_QUEUE_H
 
 #include <cstddef>
-#include <mutex>
-#include <deque>
-#include <condition_variable>
-#include <chrono>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <utility>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <assert.h>
+
+/***************************************************
+ * BlockDeque structure
+ *
+ *        dequeue_pos              enqueue_pos
+ *             |                        |
+ *   cells: | free | item | item | item | free | free |
+ *   seq:     p+cap  p+1    p+2    p+3    p+4    p+5
+ *
+ * A bounded multi-producer, multi-consumer FIFO over an array of
+ * cells, without a lock. Every cell carries a sequence number telling
+ * which position may use it next: a producer claims position p with a
+ * CAS on enqueue_pos once the cell's sequence is p, writes the item
+ * and sets it to p + 1; a consumer claims p when the sequence is p + 1,
+ * moves the item out and sets it to p + capacity, freeing the cell for
+ * the next lap. Cells and both positions sit on cache lines of their
+ * own, so producers and consumers do not share a line.
+ *
+ * The try_ calls never wait. The others wait as WaitStrategy says:
+ * spin, then yield, then park on a futex until the other side wakes
+ * them. Waking only costs a syscall while somebody is parked.
+ *
+ ****************************************************/
 
 template <class T>
 class BlockDeque{
- private:
-    std::deque<T> m_deq;
-
-    size_t m_capacity;
-
-    std::mutex m_mtx;
-
-    bool m_is_closed;
-
-    std::condition_variable m_cond_customer;
-
-    std::condition_variable m_cond_producer;
-   
 public:
+    struct WaitStrategy {
+        unsigned spins;
+        unsigned yields;
+        // Without parking a waiter keeps yielding.
+        bool park;
+    };
+
+    // Capacity is rounded up to a power of two.
     explicit BlockDeque(size_t MaxCapacity = 1000);
 
     ~BlockDeque();
 
+    BlockDeque(const BlockDeque&) = delete;
+    BlockDeque& operator=(const BlockDeque&) = delete;
+
+    void SetWaitStrategy(const WaitStrategy& strategy) { wait = strategy; }
+
+    // Drops every queued item.
     void clear();
 
+    // size, empty and full are a snapshot, as of some moment during the call.
     bool empty();
 
     bool full();
 
+    size_t size();
+
+    size_t capacity();
+
+    bool try_push(const T& item);
+    bool try_push(T&& item);
+    bool try_pop(T& item);
+
+    // Waits for space. Dropped once the queue is closed.
+    void push_back(const T& item);
+    void push_back(T&& item);
+
+    // Moves "n" items in order, as many at a time as there is space for.
+    // Returns the count pushed, less than "n" only once the queue is closed.
+    size_t push_n(T* items, size_t n);
+    size_t try_push_n(T* items, size_t n);
+
+    // Waits for an item. False once the queue is closed and drained.
     bool pop(T& item);
 
+    // Waits at most "timeout" seconds.
     bool pop(T& item, int timeout);
 
+    // Moves up to "max" items to "items", waiting for the first one.
+    // Returns 0 once the queue is closed and drained.
+    size_t pop_n(T* items, size_t max);
+    size_t try_pop_n(T* items, size_t max);
+
+    // Wakes every waiter. Pushes fail from now on, pops drain what is left.
     void Close();
 
-    size_t size();
+    // Wakes a parked consumer.
+    void flush();
 
-    size_t capacity();
+private:
+    static constexpr size_t CACHE_LINE = 64;
 
-    T front();
+    struct alignas(CACHE_LINE) Cell {
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
 
-    T back();
+        T* Item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
 
-    void push_back(const T& item);
+    Cell* cells;
+    size_t mask;
+    WaitStrategy wait;
 
-    void push_front(const T& item);
+    alignas(CACHE_LINE) std::atomic<size_t> enqueue_pos;
+    alignas(CACHE_LINE) std::atomic<size_t> dequeue_pos;
 
-    void flush();
+    // Bumped after a push or pop while somebody is parked on it, and on Close.
+    alignas(CACHE_LINE) std::atomic<uint32_t> push_epoch;
+    std::atomic<uint32_t> push_waiters;
+    alignas(CACHE_LINE) std::atomic<uint32_t> pop_epoch;
+    std::atomic<uint32_t> pop_waiters;
+    std::atomic<bool> is_closed;
+
+    template<class U>
+    bool TryPush(U&& item);
+
+    // Claims up to "max" cells at "pos": free ones to push, full ones to pop.
+    size_t Claim(std::atomic<size_t>& pos, size_t offset, size_t max, size_t& first);
+
+    // True when the cell at "pos" is ready: free to push with offset 0,
+    // full to pop with offset 1.
+    bool Ready(std::atomic<size_t>& pos, size_t offset) {
+        size_t p = pos.load(std::memory_order_relaxed);
+        return cells[p & mask].sequence.load(std::memory_order_acquire) == p + offset;
+    }
+
+    // One round of waiting for the cell at "pos", "round" counts from 0.
+    // "seen" is the "epoch" read before the caller's last try; parking
+    // returns once it changes, or at "deadline" when that is set.
+    void Wait(unsigned round, std::atomic<size_t>& pos, size_t offset,
+              std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiters,
+              uint32_t seen, const struct timespec* deadline);
+    static void Wake(std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiters);
 
+    static void CpuRelax();
 };
 
+template<class T>
+BlockDeque<T>::BlockDeque(size_t MaxCapacity) {
+    assert(MaxCapacity > 0);
+    size_t cap = 1;
+    while(cap < MaxCapacity) {
+        cap <<= 1;
+    }
+    cells = new Cell[cap];
+    for(size_t i = 0; i < cap; ++i) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mask = cap - 1;
+    wait = WaitStrategy{64, 16, true};
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos.store(0, std::memory_order_relaxed);
+    push_epoch = pop_epoch = 0;
+    push_waiters = pop_waiters = 0;
+    is_closed = false;
+}
+
+template<class T>
+BlockDeque<T>::~BlockDeque() {
+    Close();
+    clear();
+    delete[] cells;
+}
+
+template<class T>
+void BlockDeque<T>::Close() {
+    is_closed.store(true);
+    push_epoch.fetch_add(1);
+    pop_epoch.fetch_add(1);
+    syscall(SYS_futex, &push_epoch, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    syscall(SYS_futex, &pop_epoch, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+template<class T>
+void BlockDeque<T>::flush() {
+    push_epoch.fetch_add(1);
+    syscall(SYS_futex, &push_epoch, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+template<class T>
+void BlockDeque<T>::clear() {
+    T item;
+    while(try_pop(item)) {
+    }
+}
+
+template<class T>
+size_t BlockDeque<T>::size() {
+    size_t head = dequeue_pos.load(std::memory_order_relaxed);
+    size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+template<class T>
+size_t BlockDeque<T>::capacity() {
+    return mask + 1;
+}
+
+template<class T>
+bool BlockDeque<T>::empty() {
+    return size() == 0;
+}
+
+template<class T>
+bool BlockDeque<T>::full() {
+    return size() >= capacity();
+}
+
+template<class T>
+size_t BlockDeque<T>::Claim(std::atomic<size_t>& pos, size_t offset, size_t max, size_t& first) {
+    size_t start = pos.load(std::memory_order_relaxed);
+    while(true) {
+        size_t n = 0;
+        while(n < max) {
+            size_t seq = cells[(start + n) & mask].sequence.load(std::memory_order_acquire);
+            if(seq != start + n + offset) {
+                break;
+            }
+            ++n;
+        }
+        if(n == 0) {
+            // Either the cell is not ready, or another thread moved "pos".
+            size_t now = pos.load(std::memory_order_relaxed);
+            if(now == start) {
+                return 0;
+            }
+            start = now;
+            continue;
+        }
+        if(pos.compare_exchange_weak(start, start + n, std::memory_order_relaxed)) {
+            first = start;
+            return n;
+        }
+    }
+}
+
+template<class T>
+template<class U>
+bool BlockDeque<T>::TryPush(U&& item) {
+    size_t pos;
+    if(is_closed.load(std::memory_order_relaxed) || Claim(enqueue_pos, 0, 1, pos) == 0) {
+        return false;
+    }
+    Cell& cell = cells[pos & mask];
+    new (cell.storage) T(std::forward<U>(item));
+    cell.sequence.store(pos + 1, std::memory_order_release);
+    Wake(push_epoch, pop_waiters);
+    return true;
+}
+
+template<class T>
+bool BlockDeque<T>::try_push(const T& item) {
+    return TryPush(item);
+}
+
+template<class T>
+bool BlockDeque<T>::try_push(T&& item) {
+    return TryPush(std::move(item));
+}
+
+template<class T>
+size_t BlockDeque<T>::try_push_n(T* items, size_t n) {
+    size_t pos;
+    if(n == 0 || is_closed.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    size_t claimed = Claim(enqueue_pos, 0, std::min(n, capacity()), pos);
+    for(size_t i = 0; i < claimed; ++i) {
+        Cell& cell = cells[(pos + i) & mask];
+        new (cell.storage) T(std::move(items[i]));
+        cell.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    if(claimed > 0) {
+        Wake(push_epoch, pop_waiters);
+    }
+    return claimed;
+}
+
+template<class T>
+bool BlockDeque<T>::try_pop(T& item) {
+    return try_pop_n(&item, 1) == 1;
+}
+
+template<class T>
+size_t BlockDeque<T>::try_pop_n(T* items, size_t max) {
+    size_t pos;
+    if(max == 0) {
+        return 0;
+    }
+    size_t claimed = Claim(dequeue_pos, 1, std::min(max, capacity()), pos);
+    for(size_t i = 0; i < claimed; ++i) {
+        Cell& cell = cells[(pos + i) & mask];
+        T* stored = cell.Item();
+        items[i] = std::move(*stored);
+        stored->~T();
+        cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+    }
+    if(claimed > 0) {
+        Wake(pop_epoch, push_waiters);
+    }
+    return claimed;
+}
+
+template<class T>
+void BlockDeque<T>::push_back(const T& item) {
+    for(unsigned round = 0; !is_closed.load(std::memory_order_relaxed); ++round) {
+        uint32_t seen = pop_epoch.load(std::memory_order_acquire);
+        if(TryPush(item)) {
+            return;
+        }
+        Wait(round, enqueue_pos, 0, pop_epoch, push_waiters, seen, nullptr);
+    }
+}
+
+template<class T>
+void BlockDeque<T>::push_back(T&& item) {
+    for(unsigned round = 0; !is_closed.load(std::memory_order_relaxed); ++round) {
+        uint32_t seen = pop_epoch.load(std::memory_order_acquire);
+        // TryPush only moves from "item" once it has a cell.
+        if(TryPush(std::move(item))) {
+            return;
+        }
+        Wait(round, enqueue_pos, 0, pop_epoch, push_waiters, seen, nullptr);
+    }
+}
+
+template<class T>
+size_t BlockDeque<T>::push_n(T* items, size_t n) {
+    size_t done = 0;
+    for(unsigned round = 0; done < n && !is_closed.load(std::memory_order_relaxed); ++round) {
+        uint32_t seen = pop_epoch.load(std::memory_order_acquire);
+        size_t pushed = try_push_n(items + done, n - done);
+        if(pushed > 0) {
+            done += pushed;
+            round = 0;
+            continue;
+        }
+        Wait(round, enqueue_pos, 0, pop_epoch, push_waiters, seen, nullptr);
+    }
+    return done;
+}
+
+template<class T>
+bool BlockDeque<T>::pop(T& item) {
+    return pop_n(&item, 1) == 1;
+}
+
+template<class T>
+bool BlockDeque<T>::pop(T& item, int timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout;
+    for(unsigned round = 0; ; ++round) {
+        uint32_t seen = push_epoch.load(std::memory_order_acquire);
+        if(try_pop(item)) {
+            return true;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(is_closed.load() || now.tv_sec > deadline.tv_sec ||
+           (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+            return try_pop(item);
+        }
+        Wait(round, dequeue_pos, 1, push_epoch, pop_waiters, seen, &deadline);
+    }
+}
+
+template<class T>
+size_t BlockDeque<T>::pop_n(T* items, size_t max) {
+    for(unsigned round = 0; ; ++round) {
+        uint32_t seen = push_epoch.load(std::memory_order_acquire);
+        size_t popped = try_pop_n(items, max);
+        if(popped > 0) {
+            return popped;
+        }
+        if(is_closed.load()) {
+            // Pushes that claimed a cell before Close may still be landing.
+            return try_pop_n(items, max);
+        }
+        Wait(round, dequeue_pos, 1, push_epoch, pop_waiters, seen, nullptr);
+    }
+}
+
+template<class T>
+void BlockDeque<T>::Wait(unsigned round, std::atomic<size_t>& pos, size_t offset,
+                         std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiters,
+                         uint32_t seen, const struct timespec* deadline) {
+    if(round < wait.spins) {
+        CpuRelax();
+        return;
+    }
+    if(round < wait.spins + wait.yields || !wait.park) {
+        std::this_thread::yield();
+        return;
+    }
+    // Registered first and checked after: whoever makes the cell ready
+    // later sees us in "waiters" and bumps "epoch", which the futex checks.
+    waiters.fetch_add(1);
+    if(!Ready(pos, offset) && !is_closed.load() && epoch.load() == seen) {
+        struct timespec timeout;
+        struct timespec* relative = nullptr;
+        if(deadline) {
+            clock_gettime(CLOCK_MONOTONIC, &timeout);
+            long long ns = (deadline->tv_sec - timeout.tv_sec) * 1000000000LL + (deadline->tv_nsec - timeout.tv_nsec);
+            ns = ns > 0 ? ns : 0;
+            timeout.tv_sec = ns / 1000000000LL;
+            timeout.tv_nsec = ns % 1000000000LL;
+            relative = &timeout;
+        }
+        syscall(SYS_futex, &epoch, FUTEX_WAIT_PRIVATE, seen, relative, nullptr, 0);
+    }
+    waiters.fetch_sub(1);
+}
+
+template<class T>
+void BlockDeque<T>::Wake(std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiters) {
+    // Orders our cell update before the read of "waiters", against the
+    // waiter's registration before its read of "epoch".
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(waiters.load(std::memory_order_relaxed) > 0) {
+        epoch.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &epoch, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+
+template<class T>
+void BlockDeque<T>::CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 #endif
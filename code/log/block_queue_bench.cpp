@@ -0,0 +1,139 @@
+/*
+ * block_queue_bench: throughput of BlockDeque under contention, from 1
+ * to 64 producers, against a std::deque guarded by one mutex and two
+ * condition variables, the design BlockDeque replaced.
+ *
+ *   block_queue_bench [items] [consumers] [capacity]
+ *
+ * Every run pushes "items" ints split across the producers, and the
+ * consumers pop until all of them arrived. Each item is counted once,
+ * a lost or doubled item exits with status 1.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "./block_queue.h"
+
+namespace {
+
+// The baseline: one lock for both ends, waits on a condition variable.
+class MutexDeque {
+public:
+    explicit MutexDeque(size_t capacity) : capacity(capacity), closed(false) {}
+
+    void push_back(int item) {
+        std::unique_lock<std::mutex> locker(mtx);
+        not_full.wait(locker, [this] { return deq.size() < capacity || closed; });
+        deq.push_back(item);
+        not_empty.notify_one();
+    }
+
+    bool pop(int& item) {
+        std::unique_lock<std::mutex> locker(mtx);
+        not_empty.wait(locker, [this] { return !deq.empty() || closed; });
+        if(deq.empty()) {
+            return false;
+        }
+        item = deq.front();
+        deq.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> locker(mtx);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    std::deque<int> deq;
+    size_t capacity;
+    bool closed;
+    std::mutex mtx;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+// Returns millions of items per second, or a negative value when the
+// consumers did not get every item exactly once.
+template<typename Queue>
+double Run(Queue& queue, int producers, int consumers, long items) {
+    std::vector<std::atomic<int>> seen(items);
+    std::atomic<long> popped(0);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < consumers; ++i) {
+        threads.emplace_back([&] {
+            int item;
+            while(queue.pop(item)) {
+                seen[item].fetch_add(1, std::memory_order_relaxed);
+                popped.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    std::vector<std::thread> senders;
+    for(int i = 0; i < producers; ++i) {
+        senders.emplace_back([&, i] {
+            for(long item = i; item < items; item += producers) {
+                queue.push_back(static_cast<int>(item));
+            }
+        });
+    }
+    for(std::thread& sender : senders) {
+        sender.join();
+    }
+    while(popped.load() < items) {
+        std::this_thread::yield();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    queue.Close();
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for(const std::atomic<int>& count : seen) {
+        if(count.load() != 1) {
+            return -1;
+        }
+    }
+    return items / seconds / 1e6;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    long items = argc > 1 ? atol(argv[1]) : 2000000;
+    int consumers = argc > 2 ? atoi(argv[2]) : 1;
+    size_t capacity = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1024;
+    if(items <= 0 || items > 0x7fffffff || consumers <= 0 || capacity == 0) {
+        fprintf(stderr, "usage: %s [items] [consumers] [capacity]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%ld items, %d consumers, capacity %zu, %u cpus\n", items, consumers, capacity,
+           std::thread::hardware_concurrency());
+    printf("%9s %14s %14s\n", "producers", "mutex Mops/s", "mpmc Mops/s");
+    for(int producers : {1, 2, 4, 8, 16, 32, 64}) {
+        MutexDeque baseline(capacity);
+        BlockDeque<int> queue(capacity);
+        double mutex_rate = Run(baseline, producers, consumers, items);
+        double mpmc_rate = Run(queue, producers, consumers, items);
+        if(mutex_rate < 0 || mpmc_rate < 0) {
+            fprintf(stderr, "items lost or doubled with %d producers\n", producers);
+            return 1;
+        }
+        printf("%9d %14.2f %14.2f\n", producers, mutex_rate, mpmc_rate);
+    }
+    return 0;
+}
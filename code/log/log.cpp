@@ -1,49 +1,185 @@
 #include "./log.h"
 
-Log::Log() {
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+// Precedes every record in a staging ring.
+struct RecordHeader {
+    long long stamp;
+    uint32_t len;
+    // 0 for a text line, the call site's id + 1 for staged arguments.
+    int32_t site;
+};
+
+// "pending" of a thread that is reading the clock for its next line.
+const long long BUSY = -1;
+
+long long Stamp(const struct timeval& tv) {
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+using log_binary::TimePrefix;
+using log_binary::LocalPrefix;
+
+// Formats one line, '\n' included, into [dst, dst + size) the way snprintf
+// does: writes what fits, NUL terminated, and returns the full length.
+size_t FormatLine(char* dst, size_t size, const TimePrefix& prefix, long usec,
+                  int level, const char* format, va_list v_list) {
+    char head[log_binary::LINE_HEAD_BYTES];
+    size_t len = log_binary::LineHead(head, prefix, usec, level);
+    if(size > 0) {
+        size_t n = std::min(len, size - 1);
+        memcpy(dst, head, n);
+        dst[n] = '\0';
+    }
+
+    va_list args;
+    va_copy(args, v_list);
+    int n = vsnprintf(len < size ? dst + len : nullptr, len < size ? size - len : 0, format, args);
+    va_end(args);
+    len += n > 0 ? n : 0;
+
+    if(len + 1 < size) {
+        dst[len] = '\n';
+        dst[len + 1] = '\0';
+    }
+    return len + 1;
+}
+
+size_t FormatLineF(char* dst, size_t size, const TimePrefix& prefix, long usec,
+                   int level, const char* format, ...) {
+    va_list v_list;
+    va_start(v_list, format);
+    size_t len = FormatLine(dst, size, prefix, usec, level, format, v_list);
+    va_end(v_list);
+    return len;
+}
+
+} // namespace
+
+struct Log::Staging {
+    RingBuffer ring;
+
+    // Stamp of the line being staged, BUSY while the clock is read, 0 in between.
+    std::atomic<long long> pending;
+
+    // Lines staged since the thread last woke the write thread, its own.
+    size_t unwoken;
+
+    // Lines that found the ring full, its own, for OVERLOAD_SAMPLE.
+    unsigned overloads;
+
+    // Set when the owning thread has exited.
+    std::atomic<bool> retired;
+
+    explicit Staging(size_t bytes) : ring(bytes), pending(0), unwoken(0), overloads(0), retired(false) {}
+};
+
+struct Log::StagingHolder {
+    std::shared_ptr<Staging> staging;
+
+    ~StagingHolder() {
+        if(staging) {
+            staging->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+Log::Log() : house_jobs(HOUSE_JOBS) {
     line_count = 0;
     time_of_day = 0;
     is_async = false;
+    is_close = false;
+    staging_bytes = STAGING_MIN_BYTES;
+    wake = false;
+    format = FORMAT_TEXT;
+    flush_lines = FLUSH_LINES;
+    flush_interval_ms = FLUSH_INTERVAL_MS;
+    flush_level = FLUSH_LEVEL;
+    unflushed_lines = 0;
+    last_flush = 0;
+    flush_wanted = 0;
+    flushed_until = 0;
+    overload_policy = OVERLOAD_BLOCK;
+    overload_level = OVERLOAD_LEVEL;
+    overload_sample_every = OVERLOAD_SAMPLE_EVERY;
+    dropped_lines = 0;
+    sampled_lines = 0;
+    merged_until = 0;
+    last_summary = 0;
+    summary_dropped = 0;
+    summary_sampled = 0;
+    summary_blocked = 0;
+    blocked_us = 0;
+    room_waiters = 0;
+    open_generation = 0;
+    file_binary = false;
+    file_generation = 0;
     fp = nullptr;
-    deque = nullptr;
     write_thread = nullptr;
+    MAX_LINES = LOG_MAX_LINES;
+    spare_fp = nullptr;
+    compress_retired = false;
+    skipped_compressions = 0;
+    house_thread = nullptr;
 }
 
 Log::~Log() {
     if(write_thread && write_thread->joinable()) {
-        while(!deque->empty()) {
-            deque->flush();
-        };
-        deque->Close();
+        {
+            std::lock_guard<std::mutex> locker(mtx);
+            is_close = true;
+        }
+        // The write thread drains the rings before it returns.
+        write_cond.notify_one();
+        room_cond.notify_all();
         write_thread->join();
     }
+    if(house_thread && house_thread->joinable()) {
+        // Files already retired are still closed, and compressed.
+        house_jobs.Close();
+        house_thread->join();
+    }
+    if(spare_fp) {
+        fclose(spare_fp);
+        unlink(spare_name.c_str());
+    }
     if(fp) {
         std::lock_guard<std::mutex> locker(mtx);
-        Flush();
-        fclose(fp);
+        Retire(HouseJob{fp, file_name}, false);
     }
 }
 
-int Log::GetLevel() {
-    std::lock_guard<std::mutex> locker(mtx);
-    return level;
+void Log::SetFlushPolicy(size_t lines, int interval_ms, int level) {
+    assert(lines > 0 && interval_ms > 0);
+    flush_lines.store(lines, std::memory_order_relaxed);
+    flush_interval_ms.store(interval_ms, std::memory_order_relaxed);
+    flush_level.store(level, std::memory_order_relaxed);
 }
 
-void Log::SetLevel(int level) {
-    std::lock_guard<std::mutex> locker(mtx);
-    this->level = level;
+void Log::SetOverloadPolicy(OVERLOAD_POLICY policy, int level, unsigned sample_every) {
+    assert(sample_every > 0);
+    overload_level.store(level, std::memory_order_relaxed);
+    overload_sample_every.store(sample_every, std::memory_order_relaxed);
+    overload_policy.store(policy, std::memory_order_relaxed);
 }
 
 void Log::Init(int level, const char* path, const char* suffix, int max_queue_capacity) {
     is_open = true;
-    this->level = level;
+    SetLevel(level);
     if(max_queue_capacity > 0) {
         is_async = true;
-        if(!deque) {
-            std::unique_ptr<BlockDeque<std::string>> new_deque(new BlockDeque<std::string>);
-            deque = move(new_deque);
-
-            std::unique_ptr<std::thread> new_thread(new std::thread(FlushLogThread));;
+        // Rings already handed out keep their size.
+        staging_bytes = std::max(STAGING_MIN_BYTES, static_cast<size_t>(max_queue_capacity) * LINE_BYTES);
+        if(!write_thread) {
+            std::unique_ptr<std::thread> new_thread(new std::thread(FlushLogThread));
             write_thread = move(new_thread);
         }
     }
@@ -58,120 +194,561 @@ void Log::Init(int level, const char* path, const char* suffix, int max_queue_ca
     struct tm t = *sys_time;
     this->path = path;
     this->suffix = suffix;
-    char file_name[LOG_NAME_LEN] = {0};
-    snprintf(file_name, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
+    char new_file[LOG_NAME_LEN] = {0};
+    snprintf(new_file, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
              this->path, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, this->suffix);
     time_of_day = t.tm_mday;
 
     {
         std::lock_guard<std::mutex> locker(mtx);
+        std::lock_guard<std::mutex> file_locker(file_mtx);
         buff.RetrieveAll();
         if(fp) {
-            Flush();
+            fflush(fp);
             fclose(fp);
         }
 
-        fp = fopen(file_name, "a");
+        fp = fopen(new_file, "a");
         if(fp == nullptr) {
             mkdir(this->path, 0777);
-            fp = fopen(file_name, "a");
+            fp = fopen(new_file, "a");
         }
         assert(fp != nullptr);
+        file_name = new_file;
+        ++file_generation;
     }
+
+    {
+        std::lock_guard<std::mutex> locker(house_mtx);
+        std::string name = std::string(this->path) + "/.next" + this->suffix;
+        if(spare_fp && name != spare_name) {
+            fclose(spare_fp);
+            unlink(spare_name.c_str());
+            spare_fp = nullptr;
+        }
+        spare_name = name;
+        if(!house_thread) {
+            house_thread.reset(new std::thread(HousekeepThread));
+        }
+    }
+    house_jobs.try_push(HouseJob{nullptr, ""});
 }
 
 void Log::Write(int level, const char* format, ...) {
+    va_list v_list;
+    va_start(v_list, format);
+    if(is_async) {
+        WriteStaged(level, format, v_list);
+        va_end(v_list);
+        return;
+    }
+
     struct timeval now = {0, 0};
     gettimeofday(&now, nullptr);
-    time_t t_sec = now.tv_sec;
-    struct tm* sys_time = localtime(&t_sec);
-    struct tm t = *sys_time;
-    va_list v_list;
-    
-    if(time_of_day != t.tm_mday || (line_count && (line_count % MAX_LINES == 0))) {
-        std::unique_lock<std::mutex> locker(mtx);
-        locker.unlock();
+    const TimePrefix& prefix = LocalPrefix(now.tv_sec);
+    const struct tm& t = prefix.t;
+
+    std::lock_guard<std::mutex> locker(mtx);
+    if(time_of_day != t.tm_mday) {
+        Rotate(t, 0);
+        time_of_day = t.tm_mday;
+        line_count = 0;
+    }
+    else if(line_count && (line_count % MAX_LINES == 0)) {
+        Rotate(t, line_count / MAX_LINES);
+    }
+    line_count++;
+
+    size_t len = FormatLine(buff.BeginWrite(), buff.WritableBytes(), prefix, now.tv_usec, level, format, v_list);
+    if(len >= buff.WritableBytes()) {
+        buff.EnsureWriteable(len + 1);
+        FormatLine(buff.BeginWrite(), buff.WritableBytes(), prefix, now.tv_usec, level, format, v_list);
+    }
+    va_end(v_list);
+    buff.HasWritten(len);
+    fwrite(buff.Peek(), 1, buff.ReadableBytes(), fp);
+    buff.RetrieveAll();
+
+    const long long stamp = Stamp(now);
+    if(level >= flush_level.load(std::memory_order_relaxed) ||
+       ++unflushed_lines >= flush_lines.load(std::memory_order_relaxed) ||
+       stamp - last_flush >= flush_interval_ms.load(std::memory_order_relaxed) * 1000LL) {
+        fflush(fp);
+        unflushed_lines = 0;
+        last_flush = stamp;
+    }
+}
+
+Log::Staging* Log::LocalStaging() {
+    thread_local StagingHolder holder;
+    if(!holder.staging) {
+        holder.staging = std::make_shared<Staging>(staging_bytes);
+        std::lock_guard<std::mutex> locker(staging_mtx);
+        stagings.push_back(holder.staging);
+    }
+    return holder.staging.get();
+}
+
+void Log::WriteStaged(int level, const char* format, va_list v_list) {
+    Staging* staging = LocalStaging();
+    RingBuffer& ring = staging->ring;
+    struct timeval now = {0, 0};
+    const long long stamp = Announce(staging, &now);
+    const TimePrefix& prefix = LocalPrefix(now.tv_sec);
 
-        char new_file[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
-        
-        if(time_of_day != t.tm_mday) {
-            snprintf(new_file, LOG_NAME_LEN - 72, "%s/%s%s", this->path, tail, this->suffix);
-            time_of_day = t.tm_mday;
-            line_count = 0;
+    // Formatted in place when it fits the free space, otherwise once more
+    // after waiting for room for all of it, or for MAX_LINE_BYTES of it.
+    size_t room = ring.WritableBytes();
+    size_t size = room > sizeof(RecordHeader) ? std::min(room - sizeof(RecordHeader), MAX_LINE_BYTES) : 0;
+    char* line = ring.BeginWrite() + sizeof(RecordHeader);
+    size_t len = FormatLine(line, size, prefix, now.tv_usec, level, format, v_list);
+    if(len >= size && size < MAX_LINE_BYTES) {
+        size = std::min(len + 1, MAX_LINE_BYTES);
+        line = Reserve(staging, level, size);
+        if(!line) {
+            return;
         }
-        else {
-            snprintf(new_file, LOG_NAME_LEN -72, "%s/%s-%d%s", this->path, tail, (line_count / MAX_LINES), this->suffix);
+        len = FormatLine(line, size, prefix, now.tv_usec, level, format, v_list);
+    }
+    if(len >= size) {
+        len = size;
+        line[len - 1] = '\n';
+    }
+    Publish(staging, level, stamp, len, 0);
+}
+
+long long Log::Announce(Staging* staging, struct timeval* now) {
+    struct timeval tv = {0, 0};
+    if(!now) {
+        now = &tv;
+    }
+    // Announced before the clock is read, so a merge that has not seen it
+    // read its own clock first, and this line gets a later stamp.
+    staging->pending.store(BUSY);
+    gettimeofday(now, nullptr);
+    const long long stamp = Stamp(*now);
+    staging->pending.store(stamp);
+    return stamp;
+}
+
+char* Log::Reserve(Staging* staging, int level, size_t len) {
+    RingBuffer& ring = staging->ring;
+    if(ring.WritableBytes() < sizeof(RecordHeader) + len && !Admit(staging, level)) {
+        staging->pending.store(0, std::memory_order_release);
+        WakeWriter();
+        return nullptr;
+    }
+    if(ring.WritableBytes() < sizeof(RecordHeader) + len && !WaitForRoom(staging, sizeof(RecordHeader) + len)) {
+        staging->pending.store(0, std::memory_order_release);
+        dropped_lines.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return ring.BeginWrite() + sizeof(RecordHeader);
+}
+
+bool Log::WaitForRoom(Staging* staging, size_t bytes) {
+    RingBuffer& ring = staging->ring;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < SPIN_YIELDS && ring.WritableBytes() < bytes; ++i) {
+        WakeWriter();
+        std::this_thread::yield();
+    }
+    bool room = true;
+    if(ring.WritableBytes() < bytes) {
+        // Still full: asleep until a merge frees space. The write thread
+        // checks room_waiters after draining, the fences pair up so either
+        // it sees this waiter or this check sees the space it freed.
+        std::unique_lock<std::mutex> locker(mtx);
+        room_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(ring.WritableBytes() < bytes && !is_close) {
+            wake.store(true);
+            write_cond.notify_one();
+            room_cond.wait(locker);
         }
+        room_waiters.fetch_sub(1);
+        room = ring.WritableBytes() >= bytes;
+    }
+    auto waited = std::chrono::steady_clock::now() - start;
+    blocked_us.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(waited).count(),
+                         std::memory_order_relaxed);
+    return room;
+}
 
-        locker.lock();
-        Flush();
-        fclose(fp);
-        fp = fopen(new_file, "a");
-        assert(fp != nullptr);
+bool Log::Admit(Staging* staging, int level) {
+    bool admit = true;
+    switch(overload_policy.load(std::memory_order_relaxed)) {
+    case OVERLOAD_DROP_NEWEST:
+        admit = false;
+        break;
+    case OVERLOAD_DROP_BELOW_LEVEL:
+        admit = level >= overload_level.load(std::memory_order_relaxed);
+        break;
+    case OVERLOAD_SAMPLE:
+        admit = staging->overloads++ % overload_sample_every.load(std::memory_order_relaxed) == 0;
+        if(admit) {
+            sampled_lines.fetch_add(1, std::memory_order_relaxed);
+        }
+        break;
+    default:
+        break;
+    }
+    if(!admit) {
+        dropped_lines.fetch_add(1, std::memory_order_relaxed);
+    }
+    return admit;
+}
+
+void Log::Publish(Staging* staging, int level, long long stamp, size_t len, int site) {
+    RingBuffer& ring = staging->ring;
+    RecordHeader header = {stamp, static_cast<uint32_t>(len), site};
+    memcpy(ring.BeginWrite(), &header, sizeof(header));
+    ring.HasWritten(sizeof(header) + len);
+    staging->pending.store(0, std::memory_order_release);
+
+    if(level >= flush_level.load(std::memory_order_relaxed) ||
+       ++staging->unwoken >= flush_lines.load(std::memory_order_relaxed) ||
+       ring.ReadableBytes() >= ring.Capacity() / 2) {
+        staging->unwoken = 0;
+        WakeWriter();
+    }
+}
+
+void Log::WakeWriter() {
+    if(!wake.exchange(true)) {
+        // Notified under mtx: the write thread is either still to check
+        // "wake" or already waiting, so the notification cannot get lost.
+        std::lock_guard<std::mutex> locker(mtx);
+        write_cond.notify_one();
     }
+}
 
+bool Log::Collect() {
     {
-        std::unique_lock<std::mutex> locker(mtx);
-        line_count++;
-        int n = snprintf(buff.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                         t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                         t.tm_hour, t.tm_min, t.tm_sec, static_cast<long>(now.tv_usec));
+        std::lock_guard<std::mutex> locker(staging_mtx);
+        // A retired ring gets no more lines, it goes once drained.
+        stagings.erase(std::remove_if(stagings.begin(), stagings.end(),
+            [](const std::shared_ptr<Staging>& staging) {
+                return staging->retired.load(std::memory_order_acquire) && staging->ring.ReadableBytes() == 0;
+            }), stagings.end());
+        sources.clear();
+        for(const std::shared_ptr<Staging>& staging : stagings) {
+            sources.push_back(staging.get());
+        }
+    }
 
-        buff.HasWritten(n);
-        AppendLogLevelTitle(level);
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    long long watermark = Stamp(now);
+    for(Staging* staging : sources) {
+        long long pending = staging->pending.load();
+        for(int i = 0; i < SPIN_YIELDS && pending == BUSY; ++i) {
+            std::this_thread::yield();
+            pending = staging->pending.load();
+        }
+        if(pending == BUSY) {
+            // Preempted while reading the clock. Its stamp is no older than
+            // the last merge, so that much is safe; the rest waits for a retry.
+            watermark = std::min(watermark, merged_until);
+            wake.store(true);
+            continue;
+        }
+        if(pending > 0 && pending < watermark) {
+            watermark = pending;
+        }
+    }
+    // Records staged later are stamped no earlier than this.
+    merged_until = std::max(merged_until, watermark);
 
-        va_start(v_list, format);
-        int m = vsnprintf(buff.BeginWrite(), buff.WritableBytes(), format, v_list);
-        va_end(v_list);
+    // Each ring is in time order already, the oldest head goes next.
+    bool merged = false;
+    while(true) {
+        Staging* next = nullptr;
+        RecordHeader head = {0, 0, 0};
+        for(Staging* staging : sources) {
+            if(staging->ring.ReadableBytes() < sizeof(RecordHeader)) {
+                continue;
+            }
+            RecordHeader header;
+            memcpy(&header, staging->ring.Peek(), sizeof(header));
+            if(header.stamp <= watermark && (!next || header.stamp < head.stamp)) {
+                next = staging;
+                head = header;
+            }
+        }
+        if(!next) {
+            break;
+        }
+        AppendRecord(head.stamp, head.site, next->ring.Peek() + sizeof(head), head.len);
+        next->ring.Retrieve(sizeof(head) + head.len);
+        merged = true;
+        if(write_buff.ReadableBytes() >= SWAP_BYTES) {
+            WriteOut(write_buff);
+        }
+    }
+    return merged;
+}
 
-        buff.HasWritten(m);
-        buff.Append("\n\0", 2);
+void Log::SummarizeOverload(bool force) {
+    unsigned long long dropped = dropped_lines.load(std::memory_order_relaxed);
+    unsigned long long blocked = blocked_us.load(std::memory_order_relaxed);
+    if((dropped == summary_dropped && blocked == summary_blocked) ||
+       (!force && merged_until - last_summary < SUMMARY_INTERVAL_MS * 1000)) {
+        return;
+    }
+    unsigned long long sampled = sampled_lines.load(std::memory_order_relaxed);
+    const TimePrefix& prefix = LocalPrefix(static_cast<time_t>(merged_until / 1000000));
+    char line[256];
+    size_t len = FormatLineF(line, sizeof(line), prefix, static_cast<long>(merged_until % 1000000), 2,
+                             "Log overloaded: %llu lines dropped, %llu sampled, %llu ms blocked "
+                             "since the last summary",
+                             dropped - summary_dropped, sampled - summary_sampled,
+                             (blocked - summary_blocked) / 1000);
+    assert(len < sizeof(line));
+    AppendRecord(merged_until, 0, line, len);
+    summary_dropped = dropped;
+    summary_sampled = sampled;
+    summary_blocked = blocked;
+    last_summary = merged_until;
+}
+
+void Log::AppendRecord(long long stamp, int site, const char* data, size_t len) {
+    const struct tm& t = LocalPrefix(static_cast<time_t>(stamp / 1000000)).t;
+    if(time_of_day != t.tm_mday) {
+        WriteOut(write_buff);
+        Rotate(t, 0);
+        time_of_day = t.tm_mday;
+        line_count = 0;
+    }
+    else if(MAX_LINES > 0 && line_count && (line_count % MAX_LINES == 0)) {
+        WriteOut(write_buff);
+        Rotate(t, line_count / MAX_LINES);
+    }
+    line_count++;
 
-        if(is_async && deque && !deque->full()) {
-            deque->push_back(buff.RetrieveAllToStr());
+    unsigned generation = file_generation.load();
+    if(open_generation != generation) {
+        // A new file: its format is settled now, a binary one starts with
+        // MAGIC unless it is appended to, and describes its sites again.
+        open_generation = generation;
+        file_binary = format.load(std::memory_order_relaxed) == FORMAT_BINARY;
+        sites_written.assign(sites_written.size(), false);
+        if(file_binary) {
+            WriteOut(write_buff);
+            std::lock_guard<std::mutex> file_locker(file_mtx);
+            struct stat st;
+            if(fstat(fileno(fp), &st) == 0 && st.st_size == 0) {
+                write_buff.Append(log_binary::MAGIC, sizeof(log_binary::MAGIC));
+            }
+        }
+    }
+
+    const log_binary::Site* info = site > 0 ? log_binary::Site::Find(site - 1) : nullptr;
+    if(!file_binary) {
+        if(info) {
+            log_binary::AppendLine(write_buff, stamp, info->level, info->format, data, len);
         }
         else {
-            fputs(buff.Peek(), fp);
+            write_buff.Append(data, len);
         }
+        return;
+    }
+    if(!info) {
+        log_binary::AppendTextEntry(write_buff, stamp, data, len);
+        return;
+    }
+    size_t id = static_cast<size_t>(info->id);
+    if(id >= sites_written.size()) {
+        sites_written.resize(id + 1, false);
+    }
+    if(!sites_written[id]) {
+        log_binary::AppendSiteEntry(write_buff, *info);
+        sites_written[id] = true;
+    }
+    log_binary::AppendRecordEntry(write_buff, stamp, info->id, data, len);
+}
 
-        buff.RetrieveAll();
+void Log::Rotate(const struct tm& t, int index) {
+    char new_file[LOG_NAME_LEN];
+    char tail[36] = {0};
+    snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+    if(index == 0) {
+        snprintf(new_file, LOG_NAME_LEN - 72, "%s/%s%s", this->path, tail, this->suffix);
+    }
+    else {
+        snprintf(new_file, LOG_NAME_LEN - 72, "%s/%s-%d%s", this->path, tail, index, this->suffix);
+    }
+
+    FILE* next = TakeSpare(new_file);
+    if(!next) {
+        // No spare ready, or the file exists already: opened here after all.
+        next = fopen(new_file, "a");
+    }
+    assert(next != nullptr);
+
+    HouseJob old{nullptr, file_name};
+    {
+        std::lock_guard<std::mutex> file_locker(file_mtx);
+        old.fp = fp;
+        fp = next;
+        file_name = new_file;
+        ++file_generation;
+    }
+    if(!house_jobs.try_push(old)) {
+        // The housekeeping thread is behind: closed here, left uncompressed.
+        Retire(old, false);
+        if(compress_retired.load()) {
+            skipped_compressions.fetch_add(1, std::memory_order_relaxed);
+        }
     }
 }
 
-void Log::AppendLogLevelTitle(int level) {
-    switch(level) {
-    case 0:
-        buff.Append("[debug]: ", 9);
-        break;
-    case 1:
-        buff.Append("[info] : ", 9);
-        break;
-    case 2:
-        buff.Append("[warn] : ", 9);
-        break;
-    case 3:
-        buff.Append("[error]: ", 9);
-        break;
-    default:
-        buff.Append("[info] : ", 9);
-        break;
+FILE* Log::TakeSpare(const char* name) {
+    FILE* spare = nullptr;
+    {
+        std::lock_guard<std::mutex> locker(house_mtx);
+        // Renamed under house_mtx: the next spare is only created after this.
+        if(spare_fp && renameat2(AT_FDCWD, spare_name.c_str(), AT_FDCWD, name, RENAME_NOREPLACE) == 0) {
+            spare = spare_fp;
+            spare_fp = nullptr;
+        }
+    }
+    house_jobs.try_push(HouseJob{nullptr, ""});
+    return spare;
+}
+
+void Log::HousekeepThread() {
+    Log::Instance()->Housekeep();
+}
+
+void Log::Housekeep() {
+    HouseJob job;
+    // Returns once closed and drained.
+    while(house_jobs.pop(job)) {
+        if(job.fp) {
+            Retire(job, compress_retired.load());
+            continue;
+        }
+        std::unique_lock<std::mutex> locker(house_mtx);
+        if(spare_fp) {
+            continue;
+        }
+        std::string name = spare_name;
+        locker.unlock();
+        FILE* spare = OpenSpare(name);
+        locker.lock();
+        if(name == spare_name && !spare_fp) {
+            spare_fp = spare;
+        }
+        else if(spare) {
+            // Init moved the log meanwhile.
+            fclose(spare);
+            unlink(name.c_str());
+        }
+    }
+}
+
+FILE* Log::OpenSpare(const std::string& name) {
+    FILE* spare = fopen(name.c_str(), "w");
+    if(spare) {
+        // Reserved blocks past the end, the size stays 0 and appends start at 0.
+        fallocate(fileno(spare), FALLOC_FL_KEEP_SIZE, 0, PREALLOCATE_BYTES);
+    }
+    return spare;
+}
+
+void Log::Retire(const HouseJob& file, bool compress) {
+    fflush(file.fp);
+    struct stat st;
+    // Gives back what was preallocated and not written: truncating to the
+    // size frees blocks past the end, a hole punched there is a no-op.
+    if(fstat(fileno(file.fp), &st) < 0 || ftruncate(fileno(file.fp), st.st_size) < 0) {
+        fprintf(stderr, "log: cannot trim %s: %s\n", file.name.c_str(), strerror(errno));
+    }
+    fclose(file.fp);
+    if(!compress) {
+        return;
+    }
+
+    // Appended as one more gzip member when "<name>.gz" exists already.
+    std::string gz_name = file.name + ".gz";
+    FILE* in = fopen(file.name.c_str(), "rb");
+    gzFile out = in ? gzopen(gz_name.c_str(), "ab") : nullptr;
+    bool ok = in && out;
+    char chunk[64 * 1024];
+    size_t n;
+    while(ok && (n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        ok = gzwrite(out, chunk, static_cast<unsigned>(n)) == static_cast<int>(n);
+    }
+    ok = ok && !ferror(in);
+    if(out && gzclose(out) != Z_OK) {
+        ok = false;
+    }
+    if(in) {
+        fclose(in);
+    }
+    if(ok) {
+        unlink(file.name.c_str());
     }
 }
 
 void Log::Flush() {
     if(is_async) {
-        deque->flush();
+        struct timeval now = {0, 0};
+        gettimeofday(&now, nullptr);
+        const long long stamp = Stamp(now);
+        std::unique_lock<std::mutex> locker(mtx);
+        flush_wanted = std::max(flush_wanted, stamp);
+        write_cond.notify_one();
+        flush_cond.wait(locker, [this, stamp] {
+            return flushed_until >= stamp || is_close;
+        });
+        return;
     }
+    std::lock_guard<std::mutex> locker(mtx);
+    fflush(fp);
+    unflushed_lines = 0;
+}
+
+void Log::WriteOut(Buffer& out) {
+    std::lock_guard<std::mutex> file_locker(file_mtx);
+    fwrite(out.Peek(), 1, out.ReadableBytes(), fp);
     fflush(fp);
+    out.RetrieveAll();
 }
 
 void Log::AsyncWrite() {
-    std::string str = "";
-    while(deque->pop(str)) {
-        std::lock_guard<std::mutex> locker(mtx);
-        fputs(str.c_str(), fp);
+    while(true) {
+        bool closing = false;
+        {
+            std::unique_lock<std::mutex> locker(mtx);
+            write_cond.wait_for(locker, std::chrono::milliseconds(flush_interval_ms.load()), [this] {
+                return is_close || wake.load() || flush_wanted > flushed_until;
+            });
+            wake.store(false);
+            closing = is_close;
+        }
+
+        bool merged = Collect();
+        // Pairs with the fence in WaitForRoom.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(room_waiters.load() > 0) {
+            std::lock_guard<std::mutex> locker(mtx);
+            room_cond.notify_all();
+        }
+        SummarizeOverload(closing && !merged);
+        if(write_buff.ReadableBytes() > 0) {
+            WriteOut(write_buff);
+        }
+        {
+            // Every WriteOut ends with fflush.
+            std::lock_guard<std::mutex> locker(mtx);
+            flushed_until = merged_until;
+        }
+        flush_cond.notify_all();
+        if(closing && !merged) {
+            return;
+        }
     }
 }
 
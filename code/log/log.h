@@ -3,20 +3,126 @@
 
 #include <mutex>
 #include <thread>
+#include <memory>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <condition_variable>
 #include <stdarg.h>    //va_start va_end
 #include <sys/time.h>
 #include <sys/stat.h>  // mdkir
 #include <assert.h>
 
-#include "./block_queue.h"
 #include "../buffer/buffer.h"
+#include "../buffer/ring_buffer.h"
+#include "./log_binary.h"
+#include "./block_queue.h"
+
+/***************************************************
+ * Async mode, per-thread staging
+ *
+ *   thread A: Write() --> ring A --+
+ *   thread B: Write() --> ring B --+--merge by time--> write_buff --fwrite--> fp
+ *   thread C: Write() --> ring C --+        (write_thread)
+ *
+ *   ring record: |stamp (us)|len|line text ... \n|
+ *
+ * Every producer thread formats its lines into a RingBuffer of its
+ * own, registered on its first line, without taking any lock. The
+ * write thread wakes as the flush policy asks, or when a ring is half
+ * full, merges the records of all rings in time order into write_buff
+ * and writes them with one fwrite per SWAP_BYTES.
+ *
+ * A record is only merged once no thread can still stage an earlier
+ * one: a producer announces the stamp of the line it is writing in
+ * "pending" before it reads the clock for it, and the merge stops at
+ * the smallest announced stamp. Rotation is decided by the write
+ * thread from the record stamps, so lines never land in the wrong
+ * file. A thread's ring is freed once the thread has exited and the
+ * ring is drained.
+ *
+ * Rotation never opens or closes a file on the thread that rotates: a
+ * housekeeping thread keeps the next file open and preallocated under
+ * a hidden name, rotating renames it into place and swaps fp, and the
+ * retired file is closed, trimmed and optionally gzipped by the
+ * housekeeping thread.
+ *
+ * With FORMAT_DEFERRED or FORMAT_BINARY a producer does not format at
+ * all: it stages its call site's id and raw arguments (see
+ * log_binary.h), and the write thread renders the text line or writes
+ * the record as it is, for log_decoder.
+ *
+ * A ring without room for a line is an overload, and the
+ * OVERLOAD_POLICY decides whether the line waits for the write thread
+ * or is dropped on the spot. Drops are counted, and the write thread
+ * writes a summary of them at most once per SUMMARY_INTERVAL_MS.
+ *
+ ****************************************************/
 
 class Log {
+public:
+    enum LOG_FORMAT {
+        // Lines are formatted by the thread that logs them.
+        FORMAT_TEXT,
+        // Arguments are staged, and formatted to text by the write thread.
+        FORMAT_DEFERRED,
+        // Arguments are staged, and written as binary records.
+        FORMAT_BINARY,
+    };
+
+    // What a line does when its thread's ring is full, async mode only.
+    enum OVERLOAD_POLICY {
+        // Waits for the write thread to make room.
+        OVERLOAD_BLOCK,
+        // Is dropped.
+        OVERLOAD_DROP_NEWEST,
+        // Is dropped below the overload level, waits otherwise.
+        OVERLOAD_DROP_BELOW_LEVEL,
+        // One in "sample_every" of a thread's lines waits, the rest are dropped.
+        OVERLOAD_SAMPLE,
+    };
+
 private:
     static const int LOG_PATH_LEN = 256;
     static const int LOG_NAME_LEN = 256;
     static const int LOG_MAX_LINES = 50000;
 
+    static constexpr size_t SWAP_BYTES = 64 * 1024;
+
+    // Default flush policy, see SetFlushPolicy.
+    static constexpr size_t FLUSH_LINES = 64;
+    static constexpr int FLUSH_INTERVAL_MS = 100;
+    static constexpr int FLUSH_LEVEL = 2;
+
+    // Default overload settings, see SetOverloadPolicy.
+    static constexpr int OVERLOAD_LEVEL = 2;
+    static constexpr unsigned OVERLOAD_SAMPLE_EVERY = 16;
+    static constexpr long long SUMMARY_INTERVAL_MS = 1000;
+
+    // Yields a thread with a full ring tries before it sleeps until the
+    // write thread made room, and the write thread waits for a line
+    // being stamped before it merges without it.
+    static constexpr int SPIN_YIELDS = 64;
+
+    // Staging ring size per thread, at least STAGING_MIN_BYTES and
+    // LINE_BYTES per line of "max_queue_capacity".
+    static constexpr size_t STAGING_MIN_BYTES = 64 * 1024;
+    static constexpr size_t LINE_BYTES = 256;
+
+    // Longer lines are cut, and end with '\n' all the same.
+    static constexpr size_t MAX_LINE_BYTES = 8 * 1024;
+
+    // Disk space reserved for the next file ahead of time, without
+    // changing its size.
+    static constexpr off_t PREALLOCATE_BYTES = 8 * 1024 * 1024;
+
+    // Jobs the housekeeping thread may have queued; a rotation beyond
+    // that closes its old file itself.
+    static constexpr size_t HOUSE_JOBS = 64;
+
+    struct Staging;
+    struct StagingHolder;
+
     const char* path;
     const char* suffix;
 
@@ -28,14 +134,89 @@ private:
     bool is_open;
     
     Buffer buff;
-    int level;
+    std::atomic<int> level;
     bool is_async;
+    bool is_close;
+
+    // Rings of the threads that have logged, read by the write thread only.
+    std::vector<std::shared_ptr<Staging>> stagings;
+    std::mutex staging_mtx;
+    size_t staging_bytes;
+    std::atomic<bool> wake;
+    std::atomic<int> format;
+
+    std::atomic<size_t> flush_lines;
+    std::atomic<int> flush_interval_ms;
+    std::atomic<int> flush_level;
+
+    std::atomic<int> overload_policy;
+    std::atomic<int> overload_level;
+    std::atomic<unsigned> overload_sample_every;
+    std::atomic<unsigned long long> dropped_lines;
+    std::atomic<unsigned long long> sampled_lines;
+    // Time lines spent waiting for room in their ring, in microseconds.
+    std::atomic<unsigned long long> blocked_us;
+
+    // Threads asleep on room_cond, under mtx, until a merge frees ring space.
+    std::atomic<int> room_waiters;
+    std::condition_variable room_cond;
+
+    // Sync mode, under mtx: lines written since the last fflush, and its time.
+    size_t unflushed_lines;
+    long long last_flush;
+
+    // Async mode, under mtx: the stamp Flush callers wait for, and the one
+    // every line up to has been fflush-ed.
+    long long flush_wanted;
+    long long flushed_until;
+    std::condition_variable flush_cond;
+
+    // Used by the write thread only: the rings of the current merge, the
+    // merged lines on their way to fp, and the local time of the last
+    // merged second.
+    std::vector<Staging*> sources;
+    Buffer write_buff;
+
+    // Used by the write thread only: the stamp every merged line is as old
+    // as, and the counters as of the last overload summary.
+    long long merged_until;
+    long long last_summary;
+    unsigned long long summary_dropped;
+    unsigned long long summary_sampled;
+    unsigned long long summary_blocked;
+
+    // The file_generation'th file opened is the one written to, whether it
+    // is binary, and the sites a binary one describes already.
+    unsigned open_generation;
+    bool file_binary;
+    std::vector<bool> sites_written;
+    std::atomic<unsigned> file_generation;
 
     FILE* fp;
-    std::unique_ptr<BlockDeque<std::string>> deque;
+    std::string file_name;
     std::unique_ptr<std::thread> write_thread;
     std::mutex mtx;
 
+    // Housekeeping: a retired file to close and maybe compress, or with
+    // a null fp, a request for a new spare file.
+    struct HouseJob {
+        FILE* fp;
+        std::string name;
+    };
+    BlockDeque<HouseJob> house_jobs;
+    // Under house_mtx: the spare file waiting under spare_name.
+    FILE* spare_fp;
+    std::string spare_name;
+    std::atomic<bool> compress_retired;
+    // Retired files left uncompressed because house_jobs was full.
+    std::atomic<unsigned long long> skipped_compressions;
+    std::unique_ptr<std::thread> house_thread;
+    std::mutex house_mtx;
+
+    // Held while fp is written or replaced, so the write thread needs no mtx for it.
+    std::mutex file_mtx;
+    std::condition_variable write_cond;
+
 public:
     void Init(int level = 1, const char* path = "./log",
               const char* suffix = ".log",
@@ -45,25 +226,137 @@ public:
     static void FlushLogThread();
 
     void Write(int level, const char* format,...);
+
+    // Stages the raw arguments of a LOG_ call site, see LOG_FORMAT.
+    template<typename... Args>
+    void WriteDeferred(const log_binary::Site& site, const Args&... args);
+
+    // Only takes effect in async mode, switching to or from FORMAT_BINARY
+    // with the next file. A binary log belongs in a file of its own: pick
+    // a suffix no text log uses.
+    void SetFormat(LOG_FORMAT format) { this->format.store(format, std::memory_order_relaxed); }
+    bool IsDeferred() const { return is_async && format.load(std::memory_order_relaxed) != FORMAT_TEXT; }
+
+    // Lines reach the file after "lines" lines, after "interval_ms", or at
+    // once for lines of "level" and above, whichever comes first. In async
+    // mode "lines" counts per thread and the write thread wakes up every
+    // "interval_ms"; in sync mode both are checked as lines are written.
+    void SetFlushPolicy(size_t lines, int interval_ms, int level);
+
+    // Gets everything written so far to the file, regardless of the policy.
+    // In async mode it waits for the write thread to merge and fflush every
+    // line stamped before the call.
     void Flush();
 
-    int GetLevel();
-    void SetLevel(int level);
+    // "level" is used by OVERLOAD_DROP_BELOW_LEVEL, "sample_every" by
+    // OVERLOAD_SAMPLE. The default is OVERLOAD_BLOCK.
+    void SetOverloadPolicy(OVERLOAD_POLICY policy, int level = OVERLOAD_LEVEL,
+                           unsigned sample_every = OVERLOAD_SAMPLE_EVERY);
+
+    // Lines dropped by the overload policy, lines OVERLOAD_SAMPLE kept, and
+    // the microseconds lines waited for room summed over threads, since the start.
+    unsigned long long DroppedLines() const { return dropped_lines.load(std::memory_order_relaxed); }
+    unsigned long long SampledLines() const { return sampled_lines.load(std::memory_order_relaxed); }
+    unsigned long long BlockedMicros() const { return blocked_us.load(std::memory_order_relaxed); }
+
+    // Has the housekeeping thread gzip every retired file to "<name>.gz".
+    // A file retired while the housekeeping queue is full is only closed,
+    // and counted here, rotation never compresses on the writing thread.
+    void SetCompressRetired(bool compress) { compress_retired.store(compress); }
+    unsigned long long SkippedCompressions() const { return skipped_compressions.load(std::memory_order_relaxed); }
+
+    int GetLevel() { return level.load(std::memory_order_relaxed); }
+    void SetLevel(int level) { this->level.store(level, std::memory_order_relaxed); }
     bool IsOpen() { return is_open; }
 
 private:
     Log();
-    void AppendLogLevelTitle(int level);
     virtual ~Log();
     void AsyncWrite();
+
+    // The calling thread's ring, registered on first use.
+    Staging* LocalStaging();
+    void WriteStaged(int level, const char* format, va_list v_list);
+
+    /*
+     * Staging a record: Announce gives the line its stamp, Reserve waits
+     * for "len" bytes behind the record header, or returns nullptr when
+     * the overload policy drops the line, Publish fills the header in
+     * and hands the record to the write thread. "site" is 0 for a text
+     * line, the site's id + 1 otherwise.
+     */
+    long long Announce(Staging* staging, struct timeval* now);
+    char* Reserve(Staging* staging, int level, size_t len);
+    // Yields, then sleeps until "bytes" are free in the ring. False when
+    // the log closes first.
+    bool WaitForRoom(Staging* staging, size_t bytes);
+    void Publish(Staging* staging, int level, long long stamp, size_t len, int site);
+
+    // Has the write thread run a merge soon.
+    void WakeWriter();
+
+    // Moves every record older than any line still being staged into
+    // write_buff, in time order. Returns false when nothing was merged.
+    bool Collect();
+
+    // Whether a line of "level" that finds its ring full gets to wait for room.
+    bool Admit(Staging* staging, int level);
+
+    // Appends a line on the lines dropped and the time blocked since the
+    // last one, when there are any and SUMMARY_INTERVAL_MS passed, or at
+    // once with "force".
+    void SummarizeOverload(bool force);
+
+    // Writes the record stamped "stamp" to write_buff, switching files
+    // first when the day changed or the file is full.
+    void AppendRecord(long long stamp, int site, const char* data, size_t len);
+
+    // Switches fp to the file for "t", the "index"th one of that day, and
+    // hands the old one to the housekeeping thread.
+    void Rotate(const struct tm& t, int index);
+
+    // Renames the spare file to "name" unless that exists, and returns it,
+    // or nullptr when there is none ready.
+    FILE* TakeSpare(const char* name);
+
+    static void HousekeepThread();
+    void Housekeep();
+    static FILE* OpenSpare(const std::string& name);
+    static void Retire(const HouseJob& file, bool compress);
+
+    // Writes out "out" under file_mtx and clears it.
+    void WriteOut(Buffer& out);
 };
 
+template<typename... Args>
+void Log::WriteDeferred(const log_binary::Site& site, const Args&... args) {
+    size_t len = log_binary::EncodedLength(site, args...);
+    if(site.id < 0 || len > MAX_LINE_BYTES) {
+        Write(site.level, site.format, args...);
+        return;
+    }
+    Staging* staging = LocalStaging();
+    long long stamp = Announce(staging, nullptr);
+    char* out = Reserve(staging, site.level, len);
+    if(!out) {
+        return;
+    }
+    log_binary::Encode(out, site, args...);
+    Publish(staging, site.level, stamp, len, site.id + 1);
+}
+
+// "format" must be a string literal.
 #define LOG_BASE(level, format, ...)                    \
     do{                                                 \
        Log* log = Log::Instance();                      \
        if(log->IsOpen() && log->GetLevel() <= level) {  \
-          log->Write(level, format, ##__VA_ARGS__);     \
-          log->Flush();                                 \
+          if(log->IsDeferred()) {                       \
+             static const log_binary::Site log_site(level, format, __FILE__, __LINE__); \
+             log->WriteDeferred(log_site, ##__VA_ARGS__);                                \
+          }                                             \
+          else {                                        \
+             log->Write(level, format, ##__VA_ARGS__);  \
+          }                                             \
        }                                                \
     } while(0);
 
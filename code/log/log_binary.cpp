@@ -0,0 +1,399 @@
+#include "./log_binary.h"
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
+
+namespace log_binary {
+
+namespace {
+
+std::atomic<const Site*>* Sites() {
+    static std::atomic<const Site*> sites[MAX_SITES];
+    return sites;
+}
+
+// One argument read back from its encoding.
+struct Arg {
+    int kind;
+    size_t size;
+    uint64_t bits;
+    double number;
+    const char* str;
+    size_t len;
+
+    long long Int() const {
+        return kind == ARG_DOUBLE ? static_cast<long long>(number) : static_cast<long long>(bits);
+    }
+
+    // The value as printf would see it for an unsigned conversion:
+    // arguments narrower than int are promoted first.
+    unsigned long long UInt() const {
+        size_t width = std::max(size, sizeof(int));
+        if(kind == ARG_DOUBLE) {
+            return static_cast<unsigned long long>(number);
+        }
+        return width >= sizeof(bits) ? bits : bits & ((1ULL << (width * 8)) - 1);
+    }
+
+    double Double() const {
+        return kind == ARG_DOUBLE ? number : static_cast<double>(static_cast<long long>(bits));
+    }
+};
+
+class ArgReader {
+public:
+    ArgReader(const char* args, size_t len) : pos(args), end(args + len) {}
+
+    bool Next(Arg& arg) {
+        if(pos >= end) {
+            return false;
+        }
+        unsigned char tag = static_cast<unsigned char>(*pos++);
+        arg.kind = tag & 0x0f;
+        arg.size = tag >> 4;
+        if(arg.kind == ARG_STRING) {
+            uint32_t len;
+            if(end - pos < static_cast<ptrdiff_t>(sizeof(len))) {
+                return false;
+            }
+            memcpy(&len, pos, sizeof(len));
+            pos += sizeof(len);
+            if(static_cast<size_t>(end - pos) < len) {
+                return false;
+            }
+            arg.str = pos;
+            arg.len = len;
+            pos += len;
+            return true;
+        }
+        if(end - pos < 8) {
+            return false;
+        }
+        if(arg.kind == ARG_DOUBLE) {
+            memcpy(&arg.number, pos, sizeof(arg.number));
+        }
+        else {
+            memcpy(&arg.bits, pos, sizeof(arg.bits));
+        }
+        pos += 8;
+        return true;
+    }
+
+private:
+    const char* pos;
+    const char* end;
+};
+
+// Walks one conversion specification after its '%': flags, width,
+// precision and length modifier. Stars are reported, the rest copied to
+// "spec" unless it is null.
+struct SpecParser {
+    const char* pos;
+    bool star_width = false;
+    bool star_precision = false;
+    bool has_precision = false;
+    int precision = -1;
+
+    explicit SpecParser(const char* pos) : pos(pos) {}
+
+    void Flags(std::string* spec) {
+        while(*pos && strchr("-+ #0'", *pos)) {
+            if(spec) *spec += *pos;
+            ++pos;
+        }
+    }
+
+    void Width(std::string* spec) {
+        if(*pos == '*') {
+            star_width = true;
+            ++pos;
+            return;
+        }
+        while(isdigit(static_cast<unsigned char>(*pos))) {
+            if(spec) *spec += *pos;
+            ++pos;
+        }
+    }
+
+    void Precision() {
+        if(*pos != '.') {
+            return;
+        }
+        ++pos;
+        has_precision = true;
+        if(*pos == '*') {
+            star_precision = true;
+            ++pos;
+            return;
+        }
+        precision = 0;
+        while(isdigit(static_cast<unsigned char>(*pos))) {
+            precision = precision * 10 + (*pos - '0');
+            ++pos;
+        }
+    }
+
+    void Length() {
+        while(*pos && strchr("hlLqjzt", *pos)) {
+            ++pos;
+        }
+    }
+};
+
+} // namespace
+
+Site::Site(int level, const char* format, const char* file, int line)
+    : level(level), format(format), file(file), line(line) {
+    for(const char* p = format; *p; ++p) {
+        if(*p != '%') {
+            continue;
+        }
+        if(p[1] == '%') {
+            ++p;
+            continue;
+        }
+        SpecParser parser(p + 1);
+        parser.Flags(nullptr);
+        parser.Width(nullptr);
+        if(parser.star_width) {
+            args.push_back(Arg{'*', -1});
+        }
+        parser.Precision();
+        if(parser.star_precision) {
+            args.push_back(Arg{'*', -1});
+        }
+        parser.Length();
+        char conversion = *parser.pos;
+        if(!conversion) {
+            break;
+        }
+        int limit = -1;
+        if(conversion == 's' && parser.star_precision) {
+            limit = -2;
+        }
+        else if(conversion == 's' && parser.has_precision) {
+            limit = parser.precision;
+        }
+        args.push_back(Arg{conversion, limit});
+        p = parser.pos;
+    }
+
+    static std::mutex mtx;
+    static size_t count = 0;
+    std::lock_guard<std::mutex> locker(mtx);
+    if(count < MAX_SITES) {
+        id = static_cast<int>(count++);
+        Sites()[id].store(this, std::memory_order_release);
+    }
+    else {
+        id = -1;
+    }
+}
+
+const Site* Site::Find(int id) {
+    if(id < 0 || static_cast<size_t>(id) >= MAX_SITES) {
+        return nullptr;
+    }
+    return Sites()[id].load(std::memory_order_acquire);
+}
+
+void ArgWriter::PutString(const char* str) {
+    if(!str) {
+        str = "(null)";
+    }
+    int limit = site.Limit(index);
+    if(limit == -2) {
+        // A negative precision counts as none.
+        limit = last_int >= 0 ? static_cast<int>(std::min<long long>(last_int, INT32_MAX)) : -1;
+    }
+    uint32_t len = static_cast<uint32_t>(limit >= 0 ? strnlen(str, limit) : strlen(str));
+    Tag(ARG_STRING, sizeof(len));
+    Raw(&len, sizeof(len));
+    Raw(str, len);
+}
+
+const char* LevelTitle(int level) {
+    switch(level) {
+    case 0:
+        return "[debug]: ";
+    case 2:
+        return "[warn] : ";
+    case 3:
+        return "[error]: ";
+    default:
+        return "[info] : ";
+    }
+}
+
+const TimePrefix& LocalPrefix(time_t sec) {
+    thread_local TimePrefix prefix;
+    if(prefix.sec != sec) {
+        localtime_r(&sec, &prefix.t);
+        int n = snprintf(prefix.text, sizeof(prefix.text), "%d-%02d-%02d %02d:%02d:%02d",
+                         prefix.t.tm_year + 1900, prefix.t.tm_mon + 1, prefix.t.tm_mday,
+                         prefix.t.tm_hour, prefix.t.tm_min, prefix.t.tm_sec);
+        prefix.len = std::min(static_cast<size_t>(n), sizeof(prefix.text) - 1);
+        prefix.sec = sec;
+    }
+    return prefix;
+}
+
+size_t LineHead(char* dst, const TimePrefix& prefix, long usec, int level) {
+    // Only the microseconds change from line to line, they are rendered by hand.
+    size_t len = prefix.len;
+    memcpy(dst, prefix.text, len);
+    dst[len++] = '.';
+    for(int i = 5; i >= 0; --i) {
+        dst[len + i] = static_cast<char>('0' + usec % 10);
+        usec /= 10;
+    }
+    len += 6;
+    dst[len++] = ' ';
+    memcpy(dst + len, LevelTitle(level), 9);
+    return len + 9;
+}
+
+void AppendLine(Buffer& out, long long stamp, int level, const char* format,
+                const char* args, size_t len) {
+    char head[LINE_HEAD_BYTES];
+    const TimePrefix& prefix = LocalPrefix(static_cast<time_t>(stamp / 1000000));
+    out.Append(head, LineHead(head, prefix, static_cast<long>(stamp % 1000000), level));
+
+    ArgReader reader(args, len);
+    std::string spec;
+    const char* p = format;
+    while(*p) {
+        const char* percent = strchr(p, '%');
+        if(!percent) {
+            out.Append(p, strlen(p));
+            break;
+        }
+        out.Append(p, percent - p);
+        if(percent[1] == '%') {
+            out.Append("%", 1);
+            p = percent + 2;
+            continue;
+        }
+
+        spec = "%";
+        Arg arg = {};
+        SpecParser parser(percent + 1);
+        parser.Flags(&spec);
+        parser.Width(&spec);
+        if(parser.star_width && reader.Next(arg)) {
+            spec += std::to_string(arg.Int());
+        }
+        parser.Precision();
+        int precision = parser.precision;
+        if(parser.star_precision) {
+            precision = reader.Next(arg) && arg.Int() >= 0 ? static_cast<int>(arg.Int()) : -1;
+        }
+        else if(!parser.has_precision) {
+            precision = -1;
+        }
+        parser.Length();
+        char conversion = *parser.pos;
+        p = conversion ? parser.pos + 1 : parser.pos;
+
+        if(!reader.Next(arg)) {
+            out.Append(percent, p - percent);
+            continue;
+        }
+        if(precision >= 0 && conversion != 's') {
+            spec += "." + std::to_string(precision);
+        }
+        switch(conversion) {
+        case 'd':
+        case 'i':
+            spec += "lld";
+            out.AppendFormat(spec.c_str(), arg.Int());
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec += "ll";
+            spec += conversion;
+            out.AppendFormat(spec.c_str(), arg.UInt());
+            break;
+        case 'c':
+            spec += 'c';
+            out.AppendFormat(spec.c_str(), static_cast<int>(arg.Int()));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec += conversion;
+            out.AppendFormat(spec.c_str(), arg.Double());
+            break;
+        case 's':
+            // The bytes were cut to the precision when they were copied.
+            spec += ".*s";
+            if(arg.kind == ARG_STRING) {
+                out.AppendFormat(spec.c_str(), static_cast<int>(arg.len), arg.str);
+            }
+            else {
+                out.AppendFormat(spec.c_str(), 6, "(null)");
+            }
+            break;
+        case 'p':
+            spec += 'p';
+            out.AppendFormat(spec.c_str(), reinterpret_cast<void*>(static_cast<uintptr_t>(arg.bits)));
+            break;
+        default:
+            out.Append(percent, p - percent);
+            break;
+        }
+    }
+    out.Append("\n", 1);
+}
+
+void AppendSiteEntry(Buffer& out, const Site& site) {
+    unsigned char type = ENTRY_SITE;
+    uint32_t id = static_cast<uint32_t>(site.id);
+    int32_t level = site.level;
+    uint32_t line = static_cast<uint32_t>(site.line);
+    uint16_t format_len = static_cast<uint16_t>(std::min<size_t>(strlen(site.format), UINT16_MAX));
+    uint16_t file_len = static_cast<uint16_t>(std::min<size_t>(strlen(site.file), UINT16_MAX));
+    out.Append(&type, sizeof(type));
+    out.Append(&id, sizeof(id));
+    out.Append(&level, sizeof(level));
+    out.Append(&line, sizeof(line));
+    out.Append(&format_len, sizeof(format_len));
+    out.Append(site.format, format_len);
+    out.Append(&file_len, sizeof(file_len));
+    out.Append(site.file, file_len);
+}
+
+void AppendRecordEntry(Buffer& out, long long stamp, int id, const char* args, size_t len) {
+    unsigned char type = ENTRY_RECORD;
+    int64_t stamp64 = stamp;
+    uint32_t id32 = static_cast<uint32_t>(id);
+    uint32_t len32 = static_cast<uint32_t>(len);
+    out.Append(&type, sizeof(type));
+    out.Append(&stamp64, sizeof(stamp64));
+    out.Append(&id32, sizeof(id32));
+    out.Append(&len32, sizeof(len32));
+    out.Append(args, len);
+}
+
+void AppendTextEntry(Buffer& out, long long stamp, const char* line, size_t len) {
+    unsigned char type = ENTRY_TEXT;
+    int64_t stamp64 = stamp;
+    uint32_t len32 = static_cast<uint32_t>(len);
+    out.Append(&type, sizeof(type));
+    out.Append(&stamp64, sizeof(stamp64));
+    out.Append(&len32, sizeof(len32));
+    out.Append(line, len);
+}
+
+} // namespace log_binary
@@ -0,0 +1,215 @@
+#ifndef WEB_SERVER_LOG_LOG_BINARY_H
+#define WEB_SERVER_LOG_LOG_BINARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <type_traits>
+
+#include "../buffer/buffer.h"
+
+/***************************************************
+ * Deferred formatting
+ *
+ *   LOG_INFO("Client[%d](%s:%d)", fd, ip, port)
+ *      |
+ *      +-- static Site: id 7, level, format, file, line  (once)
+ *      |
+ *      v
+ *   ring record: |stamp|len|site 7|INT 4 fd|STRING 9 "10.0.0.1"|INT 4 port|
+ *
+ * Instead of running printf, a producer copies its raw arguments
+ * behind the id of its call site, each argument as a tag byte (kind in
+ * the low nibble, sizeof in the high one) and its value: 8 bytes for
+ * integers, doubles and pointers, a 32 bit length and the bytes for
+ * strings. Precisions like "%.*s" are applied while copying, so the
+ * bytes a string argument points at are read only as far as printf
+ * would. AppendLine later renders the record exactly as Log::Write
+ * would have rendered the line.
+ *
+ * Binary log file, native byte order:
+ *
+ *   MAGIC
+ *   SITE   |type|id u32|level i32|line u32|format len u16|format|file len u16|file|
+ *   RECORD |type|stamp i64|id u32|args len u32|args|
+ *   TEXT   |type|stamp i64|len u32|line|
+ *
+ * A SITE entry comes before the first RECORD of that id in every file,
+ * ids are only valid within the file. log_decoder turns a file back
+ * into text lines.
+ *
+ ****************************************************/
+
+namespace log_binary {
+
+static constexpr char MAGIC[8] = {'W', 'S', 'B', 'L', 'O', 'G', '1', '\n'};
+
+// Call sites beyond this many are formatted on the calling thread.
+static constexpr size_t MAX_SITES = 4096;
+
+enum ENTRY_TYPE {
+    ENTRY_SITE = 1,
+    ENTRY_RECORD = 2,
+    ENTRY_TEXT = 3,
+};
+
+enum ARG_KIND {
+    ARG_INT = 1,
+    ARG_UINT = 2,
+    ARG_DOUBLE = 3,
+    ARG_STRING = 4,
+    ARG_POINTER = 5,
+};
+
+class Site {
+public:
+    // "format" must stay valid for good, a string literal. The id is -1
+    // once MAX_SITES sites exist.
+    Site(int level, const char* format, const char* file, int line);
+
+    Site(const Site&) = delete;
+    Site& operator=(const Site&) = delete;
+
+    // Conversion character of argument "index", '*' for a star width or
+    // precision, 0 past the last one.
+    char Conversion(size_t index) const { return index < args.size() ? args[index].conversion : 0; }
+
+    // Bytes of a string argument printf would read: -1 up to the NUL,
+    // -2 the previous argument's value, otherwise the fixed precision.
+    int Limit(size_t index) const { return index < args.size() ? args[index].limit : -1; }
+
+    static const Site* Find(int id);
+
+    int id;
+    int level;
+    const char* format;
+    const char* file;
+    int line;
+
+private:
+    struct Arg {
+        char conversion;
+        int limit;
+    };
+    std::vector<Arg> args;
+};
+
+/*
+ * Encodes arguments as described above. Constructed with a null "out"
+ * it only counts the bytes.
+ */
+class ArgWriter {
+public:
+    ArgWriter(const Site& site, char* out) : site(site), out(out), len(0), index(0), last_int(0) {}
+
+    template<typename T>
+    void Put(const T& value);
+
+    size_t Length() const { return len; }
+
+private:
+    const Site& site;
+    char* out;
+    size_t len;
+    size_t index;
+    long long last_int;
+
+    void Raw(const void* data, size_t n) {
+        if(out) {
+            memcpy(out + len, data, n);
+        }
+        len += n;
+    }
+    void Tag(ARG_KIND kind, size_t size) {
+        unsigned char tag = static_cast<unsigned char>(kind | (size << 4));
+        Raw(&tag, 1);
+    }
+    void PutString(const char* str);
+};
+
+template<typename T>
+void ArgWriter::Put(const T& value) {
+    using U = std::decay_t<T>;
+    if constexpr(std::is_enum_v<U>) {
+        Put(static_cast<std::underlying_type_t<U>>(value));
+        return;
+    }
+    else if constexpr(std::is_integral_v<U>) {
+        long long bits = std::is_signed_v<U> ? static_cast<long long>(value)
+                                             : static_cast<long long>(static_cast<unsigned long long>(value));
+        Tag(std::is_signed_v<U> ? ARG_INT : ARG_UINT, sizeof(U));
+        Raw(&bits, sizeof(bits));
+        last_int = bits;
+    }
+    else if constexpr(std::is_floating_point_v<U>) {
+        double number = static_cast<double>(value);
+        Tag(ARG_DOUBLE, sizeof(number));
+        Raw(&number, sizeof(number));
+    }
+    else if constexpr(std::is_same_v<U, const char*> || std::is_same_v<U, char*>) {
+        if(site.Conversion(index) == 'p') {
+            uint64_t bits = reinterpret_cast<uintptr_t>(static_cast<const char*>(value));
+            Tag(ARG_POINTER, sizeof(bits));
+            Raw(&bits, sizeof(bits));
+        }
+        else {
+            PutString(value);
+        }
+    }
+    else if constexpr(std::is_pointer_v<U>) {
+        uint64_t bits = reinterpret_cast<uintptr_t>(static_cast<const volatile void*>(value));
+        Tag(ARG_POINTER, sizeof(bits));
+        Raw(&bits, sizeof(bits));
+    }
+    else {
+        static_assert(sizeof(U) == 0, "only printf arguments can be logged");
+    }
+    ++index;
+}
+
+template<typename... Args>
+size_t EncodedLength(const Site& site, const Args&... args) {
+    ArgWriter writer(site, nullptr);
+    (writer.Put(args), ...);
+    return writer.Length();
+}
+
+template<typename... Args>
+void Encode(char* out, const Site& site, const Args&... args) {
+    ArgWriter writer(site, out);
+    (writer.Put(args), ...);
+}
+
+// Appends the text line Log::Write would have written, '\n' included.
+void AppendLine(Buffer& out, long long stamp, int level, const char* format,
+                const char* args, size_t len);
+
+void AppendSiteEntry(Buffer& out, const Site& site);
+void AppendRecordEntry(Buffer& out, long long stamp, int id, const char* args, size_t len);
+void AppendTextEntry(Buffer& out, long long stamp, const char* line, size_t len);
+
+const char* LevelTitle(int level);
+
+// The local time of the calling thread's last line, with its
+// "YYYY-MM-DD hh:mm:ss" rendered once per second.
+struct TimePrefix {
+    time_t sec = -1;
+    struct tm t;
+    char text[24];
+    size_t len = 0;
+};
+
+const TimePrefix& LocalPrefix(time_t sec);
+
+// Room for the longest LineHead.
+static constexpr size_t LINE_HEAD_BYTES = 48;
+
+// Renders the start of every text line, "<prefix>.uuuuuu <title>",
+// into "dst" and returns its length. Log::Write and AppendLine share it,
+// so deferred lines read the same as formatted ones.
+size_t LineHead(char* dst, const TimePrefix& prefix, long usec, int level);
+
+} // namespace log_binary
+
+#endif
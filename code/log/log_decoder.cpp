@@ -0,0 +1,154 @@
+/*
+ * log_decoder: prints binary logs written in Log::FORMAT_BINARY as the
+ * text lines FORMAT_TEXT would have written.
+ *
+ *   log_decoder 2024_01_31.blog [more files...] > 2024_01_31.log
+ *
+ * Reads standard input without arguments. Stamps are rendered in the
+ * local time zone of the machine running the decoder.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include "../buffer/buffer.h"
+#include "./log_binary.h"
+
+namespace {
+
+struct SiteInfo {
+    int level;
+    std::string format;
+};
+
+class Reader {
+public:
+    Reader(const char* data, size_t len) : pos(data), end(data + len) {}
+
+    bool AtEnd() const { return pos == end; }
+
+    template<typename T>
+    bool Get(T& value) {
+        if(static_cast<size_t>(end - pos) < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    bool Bytes(size_t len, const char*& data) {
+        if(static_cast<size_t>(end - pos) < len) {
+            return false;
+        }
+        data = pos;
+        pos += len;
+        return true;
+    }
+
+private:
+    const char* pos;
+    const char* end;
+};
+
+bool ReadAll(FILE* fp, std::string& data) {
+    char chunk[64 * 1024];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        data.append(chunk, n);
+    }
+    return !ferror(fp);
+}
+
+// Returns false when "data" is not a complete binary log.
+bool Decode(const std::string& data, const char* name) {
+    using namespace log_binary;
+    if(data.size() < sizeof(MAGIC) || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a binary log\n", name);
+        return false;
+    }
+
+    std::unordered_map<uint32_t, SiteInfo> sites;
+    Reader reader(data.data() + sizeof(MAGIC), data.size() - sizeof(MAGIC));
+    Buffer out;
+    while(!reader.AtEnd()) {
+        unsigned char type;
+        int64_t stamp;
+        uint32_t id, line, len;
+        int32_t level;
+        uint16_t format_len, file_len;
+        const char* bytes;
+        bool ok = reader.Get(type);
+        if(ok && type == ENTRY_SITE) {
+            const char* format;
+            ok = reader.Get(id) && reader.Get(level) && reader.Get(line) &&
+                 reader.Get(format_len) && reader.Bytes(format_len, format) &&
+                 reader.Get(file_len) && reader.Bytes(file_len, bytes);
+            if(ok) {
+                sites[id] = SiteInfo{level, std::string(format, format_len)};
+            }
+        }
+        else if(ok && type == ENTRY_RECORD) {
+            ok = reader.Get(stamp) && reader.Get(id) && reader.Get(len) && reader.Bytes(len, bytes);
+            if(ok) {
+                auto site = sites.find(id);
+                if(site == sites.end()) {
+                    fprintf(stderr, "%s: record of undescribed site %u\n", name, id);
+                    return false;
+                }
+                AppendLine(out, stamp, site->second.level, site->second.format.c_str(), bytes, len);
+            }
+        }
+        else if(ok && type == ENTRY_TEXT) {
+            ok = reader.Get(stamp) && reader.Get(len) && reader.Bytes(len, bytes);
+            if(ok) {
+                out.Append(bytes, len);
+            }
+        }
+        else {
+            ok = false;
+        }
+        if(!ok) {
+            fprintf(stderr, "%s: truncated or corrupt entry\n", name);
+            fwrite(out.Peek(), 1, out.ReadableBytes(), stdout);
+            return false;
+        }
+        if(out.ReadableBytes() >= 64 * 1024) {
+            fwrite(out.Peek(), 1, out.ReadableBytes(), stdout);
+            out.RetrieveAll();
+        }
+    }
+    fwrite(out.Peek(), 1, out.ReadableBytes(), stdout);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int status = 0;
+    for(int i = 1; i < argc || i == 1; ++i) {
+        const char* name = i < argc ? argv[i] : "-";
+        FILE* fp = strcmp(name, "-") == 0 ? stdin : fopen(name, "rb");
+        if(!fp) {
+            perror(name);
+            status = 1;
+            continue;
+        }
+        std::string data;
+        bool ok = ReadAll(fp, data);
+        if(fp != stdin) {
+            fclose(fp);
+        }
+        if(!ok) {
+            perror(name);
+            status = 1;
+            continue;
+        }
+        if(!Decode(data, name)) {
+            status = 1;
+        }
+    }
+    return status;
+}